@@ -30,14 +30,12 @@
 
 #include	<ctype.h>
 #include	<fcntl.h>
+#include	<poll.h>
 #include	<signal.h>
+#include	<sys/mman.h>
 #include	<sys/signalfd.h>
 #include	<sys/wait.h>
 
-#ifndef FALLOC_FL_ZERO_RANGE
-#define FALLOC_FL_ZERO_RANGE 16
-#endif
-
 static int round_size_and_verify(unsigned long long *size, int chunk)
 {
 	if (*size == 0)
@@ -102,12 +100,83 @@ int default_layout(struct supertype *st, int level, int verbose)
 	return layout;
 }
 
+/*
+ * Zeroing progress, shared between the parent and the zeroing children
+ * through an anonymous shared mapping.  Children account for what they
+ * have done so the parent can report overall progress, and so each
+ * child can throttle itself against the total rate for all devices.
+ */
+struct zero_progress {
+	unsigned long long rate;	/* bytes/sec for all devices, 0 for no limit */
+	struct timespec start;
+	int slots;
+	struct {
+		unsigned long long size;
+		unsigned long long done;
+	} dev[];
+};
+
+static struct zero_progress *zero_progress_alloc(struct shape *s, int slots)
+{
+	struct zero_progress *zp;
+	size_t len = sizeof(*zp) + slots * sizeof(zp->dev[0]);
+
+	zp = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (zp == MAP_FAILED)
+		return NULL;
+	zp->rate = s->write_zeroes_rate;
+	zp->slots = slots;
+	clock_gettime(CLOCK_MONOTONIC, &zp->start);
+	return zp;
+}
+
+static void zero_progress_free(struct zero_progress *zp)
+{
+	if (zp)
+		munmap(zp, sizeof(*zp) + zp->slots * sizeof(zp->dev[0]));
+}
+
+static void zero_progress_sum(struct zero_progress *zp,
+			      unsigned long long *done,
+			      unsigned long long *size)
+{
+	int i;
+
+	*done = *size = 0;
+	for (i = 0; i < zp->slots; i++) {
+		*done += zp->dev[i].done;
+		*size += zp->dev[i].size;
+	}
+}
+
+/* Sleep until the total zeroed by all children is within the rate limit */
+static void zero_throttle(struct zero_progress *zp)
+{
+	unsigned long long done, size, want_ms, elapsed_ms;
+	struct timespec now;
+
+	zero_progress_sum(zp, &done, &size);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed_ms = (now.tv_sec - zp->start.tv_sec) * 1000 +
+		(now.tv_nsec - zp->start.tv_nsec) / 1000000;
+	want_ms = done * 1000 / zp->rate;
+
+	if (want_ms > elapsed_ms) {
+		unsigned long long ms = want_ms - elapsed_ms;
+
+		sleep_for(ms / 1000, MSEC_TO_NSEC(ms % 1000), true);
+	}
+}
+
 static pid_t write_zeroes_fork(int fd, struct shape *s, struct supertype *st,
-			       struct mddev_dev *dv)
+			       struct mddev_dev *dv, struct zero_progress *zp,
+			       int slot)
 
 {
-	const unsigned long long req_size = 1 << 30;
+	unsigned long long req_size = 1 << 30;
 	unsigned long long offset_bytes, size_bytes, sz;
+	enum zero_method method = ZERO_FALLOCATE;
 	sigset_t sigset;
 	int ret = 0;
 	pid_t pid;
@@ -130,6 +199,20 @@ static pid_t write_zeroes_fork(int fd, struct shape *s, struct supertype *st,
 	pr_info("zeroing data from %lld to %lld on: %s\n",
 		offset_bytes, size_bytes, dv->devname);
 
+	zp->dev[slot].size = size_bytes;
+	zp->dev[slot].done = 0;
+
+	/*
+	 * With a rate limit, keep each request to about a quarter of a
+	 * second's worth so that throttling is reasonably smooth.
+	 */
+	if (zp->rate) {
+		req_size = zp->rate / 4;
+		if (req_size < ZERO_WRITE_SIZE)
+			req_size = ZERO_WRITE_SIZE;
+		req_size = ROUND_UP(req_size, 4096);
+	}
+
 	pid = fork();
 	if (pid < 0) {
 		pr_err("Could not fork to zero disks: %s\n", strerror(errno));
@@ -158,26 +241,48 @@ static pid_t write_zeroes_fork(int fd, struct shape *s, struct supertype *st,
 		if (sz >= req_size)
 			sz = req_size;
 
-		if (fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
-			      offset_bytes, sz)) {
+		ret = zero_range(fd, offset_bytes, sz, &method);
+		if (ret) {
 			pr_err("zeroing %s failed: %s\n", dv->devname,
-			       strerror(errno));
+			       strerror(-ret));
 			ret = 1;
 			break;
 		}
 
 		offset_bytes += sz;
 		size_bytes -= sz;
+		zp->dev[slot].done += sz;
+
+		if (zp->rate)
+			zero_throttle(zp);
 	}
 
 	exit(ret);
 }
 
-static int wait_for_zero_forks(int *zero_pids, int count)
+/* Returns true if a progress line was printed */
+static bool zero_progress_report(struct zero_progress *zp)
+{
+	unsigned long long done, size;
+
+	if (!zp || !isatty(fileno(stdout)))
+		return false;
+	zero_progress_sum(zp, &done, &size);
+	if (!size)
+		return false;
+	printf("\r%s: zeroing %llu%% complete", Name, done * 100 / size);
+	fflush(stdout);
+	return true;
+}
+
+static int wait_for_zero_forks(int *zero_pids, int count,
+			       struct zero_progress *zp)
 {
 	int wstatus, ret = 0, i, sfd, wait_count = 0;
 	struct signalfd_siginfo fdsi;
 	bool interrupted = false;
+	bool reported = false;
+	struct pollfd pfd;
 	sigset_t sigset;
 	ssize_t s;
 	pid_t pid;
@@ -198,8 +303,17 @@ static int wait_for_zero_forks(int *zero_pids, int count)
 		pr_err("Unable to create signalfd: %s\n", strerror(errno));
 		return 1;
 	}
+	pfd.fd = sfd;
+	pfd.events = POLLIN;
 
 	while (wait_count) {
+		/* Report progress every second until a signal arrives */
+		if (poll(&pfd, 1, 1000) == 0) {
+			if (zero_progress_report(zp))
+				reported = true;
+			continue;
+		}
+
 		s = read(sfd, &fdsi, sizeof(fdsi));
 		if (s != sizeof(fdsi)) {
 			pr_err("Invalid signalfd read: %s\n", strerror(errno));
@@ -230,6 +344,11 @@ static int wait_for_zero_forks(int *zero_pids, int count)
 
 	close(sfd);
 
+	if (reported) {
+		zero_progress_report(zp);
+		printf("\n");
+	}
+
 	if (interrupted) {
 		pr_err("zeroing interrupted!\n");
 		return 1;
@@ -246,7 +365,7 @@ static int wait_for_zero_forks(int *zero_pids, int count)
 static int add_disk_to_super(int mdfd, struct shape *s, struct context *c,
 		struct supertype *st, struct mddev_dev *dv,
 		struct mdinfo *info, int have_container, int major_num,
-		int *zero_pid)
+		int *zero_pid, struct zero_progress *zp, int slot)
 {
 	dev_t rdev;
 	int fd;
@@ -305,7 +424,7 @@ static int add_disk_to_super(int mdfd, struct shape *s, struct context *c,
 	st->ss->getinfo_super(st, info, NULL);
 
 	if (fd >= 0 && s->write_zeroes) {
-		*zero_pid = write_zeroes_fork(fd, s, st, dv);
+		*zero_pid = write_zeroes_fork(fd, s, st, dv, zp, slot);
 		if (*zero_pid <= 0) {
 			ioctl(mdfd, STOP_ARRAY, NULL);
 			close(fd);
@@ -390,6 +509,7 @@ static int add_disks(int mdfd, struct mdinfo *info, struct shape *s,
 	struct mddev_dev *moved_disk = NULL;
 	int pass, raid_disk_num, dnum;
 	int zero_pids[total_slots];
+	struct zero_progress *zp = NULL;
 	struct mddev_dev *dv;
 	struct mdinfo *infos;
 	sigset_t sigset, orig_sigset;
@@ -406,6 +526,15 @@ static int add_disks(int mdfd, struct mdinfo *info, struct shape *s,
 	sigaddset(&sigset, SIGCHLD);
 	sigprocmask(SIG_BLOCK, &sigset, &orig_sigset);
 	memset(zero_pids, 0, sizeof(zero_pids));
+	if (s->write_zeroes) {
+		zp = zero_progress_alloc(s, total_slots);
+		if (!zp) {
+			pr_err("Cannot allocate zeroing progress: %s\n",
+			       strerror(errno));
+			sigprocmask(SIG_SETMASK, &orig_sigset, NULL);
+			return 1;
+		}
+	}
 
 	infos = xmalloc(sizeof(*infos) * total_slots);
 	enable_fds(total_slots);
@@ -440,7 +569,8 @@ static int add_disks(int mdfd, struct mdinfo *info, struct shape *s,
 
 				ret = add_disk_to_super(mdfd, s, c, st, dv,
 						&infos[dnum], have_container,
-						major_num, &zero_pids[dnum]);
+						major_num, &zero_pids[dnum],
+						zp, dnum);
 				if (ret)
 					goto out;
 
@@ -466,7 +596,7 @@ static int add_disks(int mdfd, struct mdinfo *info, struct shape *s,
 		}
 
 		if (pass == 1) {
-			ret = wait_for_zero_forks(zero_pids, total_slots);
+			ret = wait_for_zero_forks(zero_pids, total_slots, zp);
 			if (ret)
 				goto out;
 
@@ -479,7 +609,8 @@ static int add_disks(int mdfd, struct mdinfo *info, struct shape *s,
 
 out:
 	if (ret)
-		wait_for_zero_forks(zero_pids, total_slots);
+		wait_for_zero_forks(zero_pids, total_slots, zp);
+	zero_progress_free(zp);
 	free(infos);
 	sigprocmask(SIG_SETMASK, &orig_sigset, NULL);
 	return ret;
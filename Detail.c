@@ -75,6 +75,65 @@ char *detail_fname_from_uuid(struct map_ent *mp, char *buf)
 	return __fname_from_uuid(mp->uuid, swap, buf, ':');
 }
 
+/*
+ * With --scan --export, Detail() runs for every array in turn.  Rather
+ * than re-reading the map file for each array and re-loading a container's
+ * metadata for each of its member arrays, keep both until
+ * Detail_scan_done().
+ */
+struct scan_container {
+	char devnm[MD_NAME_MAX];
+	struct supertype *st;
+	struct scan_container *next;
+};
+
+static struct map_ent *scan_map;
+static struct scan_container *scan_containers;
+
+static struct supertype *scan_container(struct supertype *st)
+{
+	struct scan_container *sc;
+	struct supertype *cst;
+	int cfd;
+
+	for (sc = scan_containers; sc; sc = sc->next)
+		if (strcmp(sc->devnm, st->container_devnm) == 0)
+			return sc->st;
+
+	cfd = open_dev(st->container_devnm);
+	if (cfd < 0)
+		return NULL;
+	cst = dup_super(st);
+	strcpy(cst->container_devnm, st->container_devnm);
+	if (cst->ss->load_container(cst, cfd, NULL) != 0) {
+		close(cfd);
+		free(cst);
+		return NULL;
+	}
+	close(cfd);
+
+	sc = xmalloc(sizeof(*sc));
+	snprintf(sc->devnm, sizeof(sc->devnm), "%s", st->container_devnm);
+	sc->st = cst;
+	sc->next = scan_containers;
+	scan_containers = sc;
+	return cst;
+}
+
+void Detail_scan_done(void)
+{
+	while (scan_containers) {
+		struct scan_container *sc = scan_containers;
+
+		scan_containers = sc->next;
+		sc->st->ss->free_super(sc->st);
+		free(sc->st);
+		free(sc);
+	}
+	map_free(scan_map);
+	scan_map = NULL;
+}
+
 int Detail(char *dev, struct context *c)
 {
 	/*
@@ -108,6 +167,8 @@ int Detail(char *dev, struct context *c)
 	int inactive;
 	int is_container = 0;
 	char *arrayst;
+	int scan_cache = c->scan && c->export;
+	struct supertype *shared_st = NULL;
 
 	if (fd < 0) {
 		pr_err("cannot open %s: %s\n",
@@ -162,8 +223,13 @@ int Detail(char *dev, struct context *c)
 		member = subarray;
 		container = map_dev_preferred(major(devid), minor(devid),
 					      1, c->prefer);
-		cfd = open_dev(st->container_devnm);
-		if (cfd >= 0) {
+		if (scan_cache)
+			shared_st = scan_container(st);
+		if (shared_st) {
+			free(st);
+			st = shared_st;
+			info = st->ss->container_content(st, subarray);
+		} else if ((cfd = open_dev(st->container_devnm)) >= 0) {
 			err = st->ss->load_container(st, cfd, NULL);
 			close(cfd);
 			if (err == 0)
@@ -171,8 +237,10 @@ int Detail(char *dev, struct context *c)
 		}
 	}
 
-	/* try to load a superblock. Try sra->devs first, then try ioctl */
-	if (st && !info)
+	/* try to load a superblock. Try sra->devs first, then try ioctl.
+	 * Not into a container shared with later members of the scan.
+	 */
+	if (st && !info && st != shared_st)
 		for (d = 0, subdev = sra ? sra->devs : NULL;
 		     d < max_disks || subdev;
 		     subdev ? (void)(subdev = subdev->next) : (void)(d++)){
@@ -254,7 +322,10 @@ int Detail(char *dev, struct context *c)
 	if (c->export) {
 		char nbuf[64];
 		struct map_ent *mp = NULL, *map = NULL;
+		struct map_ent **mapp = scan_cache ? &scan_map : &map;
 
+		if (c->scan)
+			printf("MD_ARRAY=%s\n", dev);
 		if (array.raid_disks) {
 			if (str)
 				printf("MD_LEVEL=%s\n", str);
@@ -277,9 +348,9 @@ int Detail(char *dev, struct context *c)
 		}
 
 		if (info && memcmp(info->uuid, uuid_zero, sizeof(int[4])) != 0)
-			mp = map_by_uuid(&map, info->uuid);
+			mp = map_by_uuid(mapp, info->uuid);
 		if (!mp)
-			mp = map_by_devnm(&map, fd2devnm(fd));
+			mp = map_by_devnm(mapp, fd2devnm(fd));
 
 		if (mp) {
 			detail_fname_from_uuid(mp, nbuf);
@@ -322,6 +393,8 @@ int Detail(char *dev, struct context *c)
 				free(sysdev);
 			}
 		}
+		if (c->scan)
+			printf("\n");
 		goto out;
 	}
 
@@ -832,7 +905,8 @@ out:
 			free(devices[d]);
 	free(devices);
 	sysfs_free(sra);
-	free(st);
+	if (st != shared_st)
+		free(st);
 	return rv;
 }
 
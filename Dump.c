@@ -19,6 +19,7 @@
 
 #include "mdadm.h"
 #include <sys/dir.h>
+#include <sys/wait.h>
 
 int Dump_metadata(char *dev, char *dir, struct context *c,
 		  struct supertype *st)
@@ -162,6 +163,63 @@ int Dump_metadata(char *dev, char *dir, struct context *c,
 	return 0;
 }
 
+/* How many devices to dump at once */
+#define DUMP_MAX_JOBS 32
+
+int Dump_metadata_list(struct mddev_dev *devlist, char *dir,
+		       struct context *c, struct supertype *st)
+{
+	/* Dump each device in 'devlist', up to the first that isn't
+	 * marked for Dump.  The devices are independent and nearly all
+	 * of the time is spent waiting for the drives, so run several
+	 * at once, each in its own child.
+	 */
+	struct mddev_dev *dv;
+	struct stat stb;
+	int running = 0;
+	int status;
+	int rv = 0;
+
+	if (!devlist->next || devlist->next->disposition != Dump)
+		return Dump_metadata(devlist->devname, dir, c, st);
+
+	if (stat(dir, &stb) != 0 ||
+	    (S_IFMT & stb.st_mode) != S_IFDIR) {
+		pr_err("--dump requires an existing directory, not: %s\n",
+			dir);
+		return 16;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	for (dv = devlist; dv && dv->disposition == Dump; dv = dv->next) {
+		pid_t pid;
+
+		if (running == DUMP_MAX_JOBS) {
+			if (wait(&status) > 0) {
+				rv |= WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+				running--;
+			}
+		}
+
+		pid = fork();
+		if (pid < 0) {
+			/* Just do it ourselves */
+			rv |= Dump_metadata(dv->devname, dir, c, st);
+			continue;
+		}
+		if (pid == 0)
+			exit(Dump_metadata(dv->devname, dir, c, st));
+		running++;
+	}
+
+	while (running && wait(&status) > 0) {
+		rv |= WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+		running--;
+	}
+	return rv;
+}
+
 int Restore_metadata(char *dev, char *dir, struct context *c,
 		     struct supertype *st, int only)
 {
@@ -28,10 +28,370 @@
 #include	"md_p.h"
 #include	"xmalloc.h"
 
+#include	<sys/wait.h>
+
 #if ! defined(__BIG_ENDIAN) && ! defined(__LITTLE_ENDIAN)
 #error no endian defined
 #endif
 
+/* How many devices to probe at once */
+#define EXAMINE_MAX_JOBS 32
+
+struct array {
+	struct supertype *st;
+	struct mdinfo info;
+	void *devs;
+	struct array *next;
+	int spares;
+	/* From a probe done in a child: the text the metadata
+	 * handler printed, in place of 'st'.
+	 */
+	char *brief;
+	char *subarrays;
+	int external;
+};
+
+static struct supertype *examine_load(char *devname, struct context *c,
+				      struct supertype *forcest,
+				      int *have_container, int *rv)
+{
+	struct supertype *st;
+	int err = 0;
+	int container = 0;
+	int fd;
+
+	*have_container = 0;
+	fd = dev_open(devname, O_RDONLY);
+	if (fd < 0) {
+		if (!c->scan) {
+			pr_err("cannot open %s: %s\n",
+			       devname, strerror(errno));
+			*rv = 1;
+		}
+		return NULL;
+	}
+
+	if (forcest)
+		st = dup_super(forcest);
+	else if (must_be_container(fd)) {
+		/* might be a container */
+		st = super_by_fd(fd, NULL);
+		container = 1;
+	} else
+		st = guess_super(fd);
+	if (st) {
+		err = 1;
+		st->ignore_hw_compat = 1;
+		if (!container)
+			err = st->ss->load_super(st, fd,
+						 (c->brief||c->scan) ? NULL
+						 :devname);
+		if (err && st->ss->load_container) {
+			err = st->ss->load_container(st, fd,
+						     (c->brief||c->scan) ? NULL
+						     :devname);
+			if (!err)
+				*have_container = 1;
+		}
+		st->ignore_hw_compat = 0;
+	} else {
+		if (!c->brief) {
+			pr_err("No md superblock detected on %s.\n", devname);
+			*rv = 1;
+		}
+		err = 1;
+	}
+	close(fd);
+
+	if (err) {
+		if (st) {
+			st->ss->free_super(st);
+			free(st);
+		}
+		return NULL;
+	}
+
+	if (c->SparcAdjust)
+		st->ss->update_super(st, NULL, UOPT_SPARC22,
+				     devname, 0, 0, NULL);
+	/* Ok, its good enough to try, though the checksum could be wrong */
+	return st;
+}
+
+static int examine_one(char *devname, struct context *c,
+		       struct supertype *forcest, struct array **arrays)
+{
+	struct supertype *st;
+	int have_container;
+	int rv = 0;
+
+	st = examine_load(devname, c, forcest, &have_container, &rv);
+	if (!st)
+		return rv;
+
+	if (c->brief && st->ss->brief_examine_super == NULL) {
+		if (!c->scan)
+			pr_err("No brief listing for %s on %s\n",
+			       st->ss->name, devname);
+		st->ss->free_super(st);
+		free(st);
+	} else if (c->brief) {
+		struct array *ap;
+		char *d;
+		for (ap = *arrays; ap; ap = ap->next) {
+			if (ap->st && st->ss == ap->st->ss &&
+			    st->ss->compare_super(ap->st, st, 0) == 0)
+				break;
+		}
+		if (!ap) {
+			ap = xcalloc(1, sizeof(*ap));
+			ap->devs = dl_head();
+			ap->next = *arrays;
+			ap->st = st;
+			*arrays = ap;
+			st->ss->getinfo_super(st, &ap->info, NULL);
+		} else {
+			st->ss->getinfo_super(st, &ap->info, NULL);
+			st->ss->free_super(st);
+			free(st);
+		}
+		if (!have_container &&
+		    !(ap->info.disk.state & (1<<MD_DISK_SYNC)))
+			ap->spares++;
+		d = dl_strdup(devname);
+		dl_add(ap->devs, d);
+	} else if (c->export) {
+		if (st->ss->export_examine_super)
+			st->ss->export_examine_super(st);
+		st->ss->free_super(st);
+		free(st);
+	} else {
+		printf("%s:\n", devname);
+		st->ss->examine_super(st, c->homehost);
+		st->ss->free_super(st);
+		free(st);
+	}
+	return rv;
+}
+
+static int examine_child(char *devname, struct context *c,
+			 struct supertype *forcest)
+{
+	/* Run in a child with stdout going to the parent.  In brief mode
+	 * the loaded metadata cannot be handed back, so send what
+	 * examine_one() would later print for it: a header giving
+	 * "spare external has-subarrays", then the ARRAY line and the
+	 * subarray lines, each terminated by a NUL.
+	 */
+	struct supertype *st;
+	struct mdinfo info;
+	int have_container;
+	int rv = 0;
+
+	if (!c->brief)
+		return examine_one(devname, c, forcest, NULL);
+
+	st = examine_load(devname, c, forcest, &have_container, &rv);
+	if (!st)
+		return rv;
+	if (st->ss->brief_examine_super == NULL) {
+		if (!c->scan)
+			pr_err("No brief listing for %s on %s\n",
+			       st->ss->name, devname);
+	} else {
+		st->ss->getinfo_super(st, &info, NULL);
+		printf("%d %d %d",
+		       !have_container && !(info.disk.state & (1<<MD_DISK_SYNC)),
+		       st->ss->external,
+		       st->ss->brief_examine_subarrays != NULL);
+		putchar(0);
+		st->ss->brief_examine_super(st, c->verbose > 0);
+		putchar(0);
+		if (st->ss->brief_examine_subarrays)
+			st->ss->brief_examine_subarrays(st, c->verbose);
+		putchar(0);
+	}
+	st->ss->free_super(st);
+	free(st);
+	return rv;
+}
+
+static void examine_merge(char *devname, char *buf, int len,
+			  struct array **arrays)
+{
+	/* Add a brief record from examine_child() to the array it
+	 * belongs to.  Members of one array print the same ARRAY line,
+	 * so that identifies the array.
+	 */
+	struct array *ap;
+	char *brief, *subarrays;
+	int spare, external, has_sub;
+
+	if (len < 3 || buf[len-1] != 0 ||
+	    sscanf(buf, "%d %d %d", &spare, &external, &has_sub) != 3)
+		return;
+	brief = buf + strlen(buf) + 1;
+	if (brief >= buf + len)
+		return;
+	subarrays = brief + strlen(brief) + 1;
+	if (subarrays >= buf + len)
+		return;
+
+	for (ap = *arrays; ap; ap = ap->next)
+		if (ap->brief && strcmp(ap->brief, brief) == 0)
+			break;
+	if (!ap) {
+		ap = xcalloc(1, sizeof(*ap));
+		ap->devs = dl_head();
+		ap->next = *arrays;
+		ap->brief = xstrdup(brief);
+		ap->subarrays = has_sub ? xstrdup(subarrays) : NULL;
+		ap->external = external;
+		*arrays = ap;
+	}
+	ap->spares += spare;
+	dl_add(ap->devs, dl_strdup(devname));
+}
+
+static char *examine_read(int fd, int *lenp)
+{
+	int size = 4096;
+	int len = 0;
+	char *buf = xmalloc(size);
+	int n;
+
+	while ((n = read(fd, buf + len, size - len)) != 0) {
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		len += n;
+		if (len == size) {
+			size *= 2;
+			buf = xrealloc(buf, size);
+		}
+	}
+	*lenp = len;
+	return buf;
+}
+
+static int examine_inline(char *devname, struct context *c,
+			  struct supertype *forcest, struct array **arrays)
+{
+	/* No child could be started for this device.  Run the child's
+	 * probe here with stdout captured, so that in brief mode the
+	 * record is merged just like those from children and members of
+	 * one array are not split between two kinds of group.
+	 */
+	FILE *f;
+	char *buf;
+	int saved;
+	int len;
+	int rv;
+
+	if (!c->brief)
+		return examine_one(devname, c, forcest, arrays);
+
+	fflush(stdout);
+	f = tmpfile();
+	saved = dup(1);
+	if (!f || saved < 0 || dup2(fileno(f), 1) < 0) {
+		pr_err("cannot examine %s: %s\n", devname, strerror(errno));
+		if (saved >= 0)
+			close(saved);
+		if (f)
+			fclose(f);
+		return 1;
+	}
+	rv = examine_child(devname, c, forcest);
+	fflush(stdout);
+	dup2(saved, 1);
+	close(saved);
+
+	lseek(fileno(f), 0, SEEK_SET);
+	buf = examine_read(fileno(f), &len);
+	fclose(f);
+	examine_merge(devname, buf, len, arrays);
+	free(buf);
+	return rv;
+}
+
+static int examine_parallel(struct mddev_dev *devlist, struct context *c,
+			    struct supertype *forcest, struct array **arrays)
+{
+	/* Probing a device is mostly waiting for a few small O_DIRECT
+	 * reads, which adds up on a large JBOD.  So probe several devices
+	 * at once, each in a child, and collect the results in device
+	 * order so that the output is the same as probing them in turn.
+	 */
+	struct mddev_dev *dv;
+	struct mddev_dev **dvs;
+	pid_t *pids;
+	int *fds;
+	int n = 0, started = 0, i;
+	int rv = 0;
+
+	for (dv = devlist; dv; dv = dv->next)
+		n++;
+	dvs = xmalloc(n * sizeof(*dvs));
+	pids = xmalloc(n * sizeof(*pids));
+	fds = xmalloc(n * sizeof(*fds));
+	for (dv = devlist, i = 0; dv; dv = dv->next, i++)
+		dvs[i] = dv;
+
+	for (i = 0; i < n; i++) {
+		int status;
+		char *buf;
+		int len;
+
+		for (; started < n && started < i + EXAMINE_MAX_JOBS;
+		     started++) {
+			int pfd[2];
+
+			pids[started] = -1;
+			if (pipe(pfd) < 0)
+				continue;
+			fflush(stdout);
+			fflush(stderr);
+			pids[started] = fork();
+			if (pids[started] == 0) {
+				close(pfd[0]);
+				dup2(pfd[1], 1);
+				close(pfd[1]);
+				exit(examine_child(dvs[started]->devname,
+						   c, forcest));
+			}
+			close(pfd[1]);
+			if (pids[started] < 0)
+				close(pfd[0]);
+			else
+				fds[started] = pfd[0];
+		}
+
+		if (pids[i] < 0) {
+			/* Just do it ourselves */
+			rv |= examine_inline(dvs[i]->devname, c, forcest, arrays);
+			continue;
+		}
+		buf = examine_read(fds[i], &len);
+		close(fds[i]);
+		if (waitpid(pids[i], &status, 0) == pids[i])
+			rv |= WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+		else
+			rv |= 1;
+		if (c->brief)
+			examine_merge(dvs[i]->devname, buf, len, arrays);
+		else
+			fwrite(buf, 1, len, stdout);
+		free(buf);
+	}
+	free(dvs);
+	free(pids);
+	free(fds);
+	return rv;
+}
+
 int Examine(struct mddev_dev *devlist,
 	    struct context *c,
 	    struct supertype *forcest)
@@ -53,117 +413,16 @@ int Examine(struct mddev_dev *devlist,
 	 * line including devices=
 	 * if devlist==NULL, use conf_get_devs()
 	 */
-	int fd;
 	int rv = 0;
+	struct array *arrays = NULL;
 
-	struct array {
-		struct supertype *st;
-		struct mdinfo info;
-		void *devs;
-		struct array *next;
-		int spares;
-	} *arrays = NULL;
-
-	for (; devlist ; devlist = devlist->next) {
-		struct supertype *st;
-		int have_container = 0;
-		int err = 0;
-		int container = 0;
-
-		fd = dev_open(devlist->devname, O_RDONLY);
-		if (fd < 0) {
-			if (!c->scan) {
-				pr_err("cannot open %s: %s\n",
-				       devlist->devname, strerror(errno));
-				rv = 1;
-			}
-			continue;
-		}
-
-		if (forcest)
-			st = dup_super(forcest);
-		else if (must_be_container(fd)) {
-			/* might be a container */
-			st = super_by_fd(fd, NULL);
-			container = 1;
-		} else
-			st = guess_super(fd);
-		if (st) {
-			err = 1;
-			st->ignore_hw_compat = 1;
-			if (!container)
-				err = st->ss->load_super(st, fd,
-							 (c->brief||c->scan) ? NULL
-							 :devlist->devname);
-			if (err && st->ss->load_container) {
-				err = st->ss->load_container(st, fd,
-							     (c->brief||c->scan) ? NULL
-							     :devlist->devname);
-				if (!err)
-					have_container = 1;
-			}
-			st->ignore_hw_compat = 0;
-		} else {
-			if (!c->brief) {
-				pr_err("No md superblock detected on %s.\n", devlist->devname);
-				rv = 1;
-			}
-			err = 1;
-		}
-		close(fd);
-
-		if (err) {
-			if (st) {
-				st->ss->free_super(st);
-				free(st);
-			}
-			continue;
-		}
+	if (devlist && devlist->next)
+		rv = examine_parallel(devlist, c, forcest, &arrays);
+	else
+		for (; devlist ; devlist = devlist->next)
+			rv |= examine_one(devlist->devname, c, forcest,
+					  &arrays);
 
-		if (c->SparcAdjust)
-			st->ss->update_super(st, NULL, UOPT_SPARC22,
-					     devlist->devname, 0, 0, NULL);
-		/* Ok, its good enough to try, though the checksum could be wrong */
-
-		if (c->brief && st->ss->brief_examine_super == NULL) {
-			if (!c->scan)
-				pr_err("No brief listing for %s on %s\n",
-				       st->ss->name, devlist->devname);
-		} else if (c->brief) {
-			struct array *ap;
-			char *d;
-			for (ap = arrays; ap; ap = ap->next) {
-				if (st->ss == ap->st->ss &&
-				    st->ss->compare_super(ap->st, st, 0) == 0)
-					break;
-			}
-			if (!ap) {
-				ap = xmalloc(sizeof(*ap));
-				ap->devs = dl_head();
-				ap->next = arrays;
-				ap->spares = 0;
-				ap->st = st;
-				arrays = ap;
-				st->ss->getinfo_super(st, &ap->info, NULL);
-			} else
-				st->ss->getinfo_super(st, &ap->info, NULL);
-			if (!have_container &&
-			    !(ap->info.disk.state & (1<<MD_DISK_SYNC)))
-				ap->spares++;
-			d = dl_strdup(devlist->devname);
-			dl_add(ap->devs, d);
-		} else if (c->export) {
-			if (st->ss->export_examine_super)
-				st->ss->export_examine_super(st);
-			st->ss->free_super(st);
-			free(st);
-		} else {
-			printf("%s:\n",devlist->devname);
-			st->ss->examine_super(st, c->homehost);
-			st->ss->free_super(st);
-			free(st);
-		}
-	}
 	if (c->brief) {
 		struct array *ap = arrays, *next;
 
@@ -171,11 +430,18 @@ int Examine(struct mddev_dev *devlist,
 			char sep='=';
 			char *d;
 			int newline = 0;
+			int external;
 
 			next = ap->next;
 
-			ap->st->ss->brief_examine_super(ap->st, c->verbose > 0);
-			if (ap->spares && !ap->st->ss->external)
+			if (ap->st) {
+				ap->st->ss->brief_examine_super(ap->st, c->verbose > 0);
+				external = ap->st->ss->external;
+			} else {
+				fputs(ap->brief, stdout);
+				external = ap->external;
+			}
+			if (ap->spares && !external)
 				newline += printf("   spares=%d", ap->spares);
 			if (c->verbose > 0) {
 				newline += printf("   devices");
@@ -186,16 +452,24 @@ int Examine(struct mddev_dev *devlist,
 					sep=',';
 				}
 			}
-			if (ap->st->ss->brief_examine_subarrays) {
+			if (ap->st ? ap->st->ss->brief_examine_subarrays != NULL
+			    : ap->subarrays != NULL) {
 				if (newline)
 					printf("\n");
-				ap->st->ss->brief_examine_subarrays(ap->st, c->verbose);
+				if (ap->st)
+					ap->st->ss->brief_examine_subarrays(ap->st, c->verbose);
+				else
+					fputs(ap->subarrays, stdout);
 			}
 			if (ap->spares || c->verbose > 0)
 				printf("\n");
 
-			ap->st->ss->free_super(ap->st);
-			free(ap->st);
+			if (ap->st) {
+				ap->st->ss->free_super(ap->st);
+				free(ap->st);
+			}
+			free(ap->brief);
+			free(ap->subarrays);
 			dl_free_all(ap->devs);
 			free(ap);
 
@@ -183,6 +183,7 @@ int Manage_stop(char *devname, int fd, int verbose, int will_retry)
 	char container[MD_NAME_MAX] = {0};
 	int err;
 	int count;
+	int waited;
 	char buf[SYSFS_MAX_BUF_SIZE];
 	unsigned long long rd1, rd2;
 
@@ -234,15 +235,14 @@ int Manage_stop(char *devname, int fd, int verbose, int will_retry)
 		 * which blocks STOP_ARRAY is probably a transient use,
 		 * so it is reasonable to retry for a while - 5 seconds.
 		 */
-		count = 25;
-		while (count &&
-		       (err = sysfs_set_str(mdi, NULL,
+		waited = 0;
+		while ((err = sysfs_set_str(mdi, NULL,
 					    "array_state",
 					    "inactive")) < 0 &&
 		       errno == EBUSY) {
 			err = errno;
-			sleep_for(0, MSEC_TO_NSEC(200), true);
-			count--;
+			if (!retry_wait(-1, &waited, 5000))
+				break;
 		}
 		if (err) {
 			if (verbose >= 0)
@@ -318,13 +318,19 @@ int Manage_stop(char *devname, int fd, int verbose, int will_retry)
 		int delay;
 		int scfd;
 
-		delay = 40;
-		while (rd1 > rd2 && delay > 0 &&
+		/* must be in the critical section - wait a bit, waking
+		 * early as the reshape makes progress
+		 */
+		scfd = sysfs_open(mdi->sys_name, NULL, "sync_completed");
+		waited = 0;
+		while (rd1 > rd2 &&
 		       sysfs_get_ll(mdi, NULL, "sync_max", &old_sync_max) == 0) {
-			/* must be in the critical section - wait a bit */
-			delay -= 1;
-			sleep_for(0, MSEC_TO_NSEC(100), true);
+			if (scfd >= 0)
+				sysfs_fd_get_str(scfd, buf, sizeof(buf));
+			if (!retry_wait(scfd, &waited, 4000))
+				break;
 		}
+		close_fd(&scfd);
 
 		if (sysfs_set_str(mdi, NULL, "sync_action", "frozen") != 0)
 			goto done;
@@ -438,12 +444,12 @@ done:
 	 * which blocks STOP_ARRAY is probably a transient use,
 	 * so it is reasonable to retry for a while - 5 seconds.
 	 */
-	count = 25; err = 0;
-	while (count && fd >= 0 &&
+	waited = 0; err = 0;
+	while (fd >= 0 &&
 	       (err = ioctl(fd, STOP_ARRAY, NULL)) < 0 && errno == EBUSY) {
 		err = errno;
-		sleep_for(0, MSEC_TO_NSEC(200), true);
-		count --;
+		if (!retry_wait(-1, &waited, 5000))
+			break;
 	}
 	if (fd >= 0 && err) {
 		if (verbose >= 0) {
@@ -1127,14 +1133,13 @@ int Manage_remove(struct supertype *tst, int fd, struct mddev_dev *dv,
 			 * drive might still have an entry in the 'holders'
 			 * directory. Try a few times to avoid a false error
 			 */
-			int count = 20;
+			int waited = 0;
 
 			do {
 				ret = sysfs_unique_holder(devnm, rdev);
 				if (ret < 2)
 					break;
-				sleep_for(0, MSEC_TO_NSEC(100), true);
-			} while (--count > 0);
+			} while (retry_wait(-1, &waited, 2000));
 
 			if (ret == 0) {
 				pr_err("%s is not a member, cannot remove.\n",
@@ -135,6 +135,7 @@ struct option long_options[] = {
 	{"auto", 1, 0, Auto}, /* Deprecated, left for backward compatibility */
 	{"assume-clean", 0, 0, AssumeClean },
 	{"write-zeroes", 0, 0, WriteZeroes },
+	{"write-zeroes-rate", 1, 0, WriteZeroesRate },
 	{"metadata", 1, 0, 'e'}, /* superblock format */
 	{"bitmap", 1, 0, Bitmap},
 	{"bitmap-chunk", 1, 0, BitmapChunk},
@@ -331,6 +332,7 @@ char Help_create[] =
 "  --consistency-policy= : Specify the policy that determines how the array\n"
 "                     -k : maintains consistency in case of unexpected shutdown.\n"
 "  --write-zeroes        : Write zeroes to the disks before creating. This will bypass initial sync.\n"
+"  --write-zeroes-rate=  : Limit on the rate of --write-zeroes over all disks, per second.\n"
 "\n"
 ;
 
@@ -467,6 +469,7 @@ char Help_misc[] =
 "  --test        -t   : exit status 0 if ok, 1 if degrade, 2 if dead, 4 if missing\n"
 "  --wait        -W   : wait for resync/rebuild/recovery to finish\n"
 "  --action=          : initiate or abort ('idle' or 'frozen') a 'check' or 'repair'.\n"
+"                       'check-dirty' checks only regions dirty in the bitmap.\n"
 ;
 
 char Help_monitor[] =
@@ -70,46 +70,102 @@ static const char *human_chunksize(unsigned long bytes)
 	return buf;
 }
 
+/* A run of dirty bits, as first bit and number of bits */
+struct bitmap_region {
+	unsigned long long start;
+	unsigned long long count;
+};
+
 typedef struct bitmap_info_s {
 	bitmap_super_t sb;
 	unsigned long long total_bits;
 	unsigned long long dirty_bits;
+	struct bitmap_region *regions;	/* only if asked for */
+	int nregions;
 } bitmap_info_t;
 
-/* count the dirty bits in the first num_bits of byte */
-static inline int count_dirty_bits_byte(char byte, int num_bits)
+/* Large enough that even a bitmap for a huge array with a small
+ * chunk size takes few reads, and a multiple of any block size
+ * as the file might be open O_DIRECT.
+ */
+#define BITMAP_READ_SIZE (1024*1024)
+
+static void bitmap_info_free(bitmap_info_t *info)
 {
-	int num = 0;
+	if (!info)
+		return;
+	free(info->regions);
+	free(info);
+}
 
-	switch (num_bits) { /* fall through... */
-		case 8:	if (byte & 128) num++;
-		case 7:	if (byte &  64) num++;
-		case 6:	if (byte &  32) num++;
-		case 5:	if (byte &  16) num++;
-		case 4:	if (byte &   8) num++;
-		case 3: if (byte &   4) num++;
-		case 2:	if (byte &   2) num++;
-		case 1:	if (byte &   1) num++;
-		default: break;
+/* count the dirty bits in the first num_bits of buf */
+static unsigned long long count_dirty_bits(char *buf,
+					   unsigned long long num_bits)
+{
+	unsigned long long i, num = 0;
+	unsigned long long bytes = num_bits / 8;
+
+	for (i = 0; i + 8 <= bytes; i += 8) {
+		__u64 w;
+
+		memcpy(&w, buf + i, 8);
+		num += __builtin_popcountll(w);
 	}
+	for (; i < bytes; i++)
+		num += __builtin_popcount((unsigned char)buf[i]);
+
+	if (num_bits % 8) /* not an even byte boundary */
+		num += __builtin_popcount((unsigned char)buf[i] &
+					  ((1 << (num_bits % 8)) - 1));
 
 	return num;
 }
 
-static int count_dirty_bits(char *buf, int num_bits)
+static void add_dirty_bit(bitmap_info_t *info, unsigned long long bit)
 {
-	int i, num = 0;
+	struct bitmap_region *r;
 
-	for (i = 0; i < num_bits / 8; i++)
-		num += count_dirty_bits_byte(buf[i], 8);
+	if (info->nregions) {
+		r = &info->regions[info->nregions - 1];
+		if (r->start + r->count == bit) {
+			r->count++;
+			return;
+		}
+	}
+	if ((info->nregions & (info->nregions - 1)) == 0)
+		info->regions = xrealloc(info->regions,
+					 sizeof(*r) * (info->nregions ? info->nregions * 2 : 1));
+	r = &info->regions[info->nregions++];
+	r->start = bit;
+	r->count = 1;
+}
 
-	if (num_bits % 8) /* not an even byte boundary */
-		num += count_dirty_bits_byte(buf[i], num_bits % 8);
+/* record runs of dirty bits among the num_bits of buf,
+ * the first of which is bit 'first' of the bitmap.
+ */
+static void find_dirty_regions(bitmap_info_t *info, char *buf,
+			       unsigned long long first,
+			       unsigned long long num_bits)
+{
+	unsigned long long i = 0;
 
-	return num;
+	while (i < num_bits) {
+		__u64 w;
+
+		if ((i & 63) == 0 && i + 64 <= num_bits) {
+			memcpy(&w, buf + i / 8, 8);
+			if (w == 0) {
+				i += 64;
+				continue;
+			}
+		}
+		if (buf[i / 8] & (1 << (i % 8)))
+			add_dirty_bit(info, first + i);
+		i++;
+	}
 }
 
-static bitmap_info_t *bitmap_fd_read(int fd, int brief)
+static bitmap_info_t *bitmap_fd_read(int fd, int brief, int regions)
 {
 	/* Note: fd might be open O_DIRECT, so we must be
 	 * careful to align reads properly
@@ -119,13 +175,13 @@ static bitmap_info_t *bitmap_fd_read(int fd, int brief)
 	void *buf;
 	unsigned int n, skip;
 
-	if (posix_memalign(&buf, 4096, 8192) != 0) {
-		pr_err("failed to allocate 8192 bytes\n");
+	if (posix_memalign(&buf, 4096, BITMAP_READ_SIZE) != 0) {
+		pr_err("failed to allocate %d bytes\n", BITMAP_READ_SIZE);
 		return NULL;
 	}
-	n = read(fd, buf, 8192);
+	n = read(fd, buf, BITMAP_READ_SIZE);
 
-	info = xmalloc(sizeof(*info));
+	info = xcalloc(1, sizeof(*info));
 
 	if (n < sizeof(info->sb)) {
 		pr_err("failed to read superblock of bitmap file: %s\n", strerror(errno));
@@ -154,15 +210,17 @@ static bitmap_info_t *bitmap_fd_read(int fd, int brief)
 		unsigned long long remaining = total_bits - read_bits;
 
 		if (n == 0) {
-			n = read(fd, buf, 8192);
+			n = read(fd, buf, BITMAP_READ_SIZE);
 			skip = 0;
 			if (n <= 0)
 				break;
 		}
-		if (remaining > (n-skip) * 8) /* we want the full buffer */
-			remaining = (n-skip) * 8;
+		if (remaining > (n-skip) * 8ULL) /* we want the full buffer */
+			remaining = (n-skip) * 8ULL;
 
 		dirty_bits += count_dirty_bits(buf+skip, remaining);
+		if (regions)
+			find_dirty_regions(info, buf+skip, read_bits, remaining);
 
 		read_bits += remaining;
 		n = 0;
@@ -180,6 +238,23 @@ out:
 	return info;
 }
 
+static void print_dirty_regions(bitmap_info_t *info)
+{
+	unsigned long long chunk = info->sb.chunksize >> 9;
+	int i;
+
+	printf("   Dirty Regions : %d (sectors of resync range)\n",
+	       info->nregions);
+	for (i = 0; i < info->nregions; i++) {
+		unsigned long long start = info->regions[i].start * chunk;
+		unsigned long long end = start + info->regions[i].count * chunk;
+
+		if (end > info->sb.sync_size)
+			end = info->sb.sync_size;
+		printf("%20llu for %llu sectors\n", start, end - start);
+	}
+}
+
 static int
 bitmap_file_open(char *filename, struct supertype **stp, int node_num, int fd)
 {
@@ -241,7 +316,7 @@ static __u32 swapl(__u32 l)
 	c[2] = t;
 	return l;
 }
-int ExamineBitmap(char *filename, int brief, struct supertype *st)
+int ExamineBitmap(char *filename, int brief, int verbose, struct supertype *st)
 {
 	/*
 	 * Read the bitmap file and display its contents
@@ -259,10 +334,9 @@ int ExamineBitmap(char *filename, int brief, struct supertype *st)
 	if (fd < 0)
 		return rv;
 
-	info = bitmap_fd_read(fd, brief);
+	info = bitmap_fd_read(fd, brief, verbose > 0);
 	if (!info) {
 		close_fd(&fd);
-		free(info);
 		return rv;
 	}
 	sb = &info->sb;
@@ -334,22 +408,27 @@ int ExamineBitmap(char *filename, int brief, struct supertype *st)
 		printf("          Bitmap : %llu bits (chunks), %llu dirty (%2.1f%%)\n",
 		       info->total_bits, info->dirty_bits,
 		       100.0 * info->dirty_bits / (info->total_bits?:1));
+		if (verbose > 0)
+			print_dirty_regions(info);
 	} else {
 		printf("   Cluster nodes : %d\n", sb->nodes);
 		printf("    Cluster name : %-64s\n", sb->cluster_name);
 		for (i = 0; i < (int)sb->nodes; i++) {
+			bitmap_info_t *node_info;
+
 			st = NULL;
 			fd = bitmap_file_open(filename, &st, i, fd);
 			if (fd < 0) {
 				printf("   Unable to open bitmap file on node: %i\n", i);
 				continue;
 			}
-			info = bitmap_fd_read(fd, brief);
-			if (!info) {
+			node_info = bitmap_fd_read(fd, brief, verbose > 0);
+			if (!node_info) {
 				printf("   Unable to read bitmap on node: %i\n", i);
 				continue;
 			}
-			free(sb);
+			bitmap_info_free(info);
+			info = node_info;
 			sb = &info->sb;
 			if (sb->magic != BITMAP_MAGIC)
 				pr_err("invalid bitmap magic 0x%x, the bitmap file appears to be corrupted\n", sb->magic);
@@ -365,12 +444,251 @@ int ExamineBitmap(char *filename, int brief, struct supertype *st)
 			printf("          Bitmap : %llu bits (chunks), %llu dirty (%2.1f%%)\n",
 			       info->total_bits, info->dirty_bits,
 			       100.0 * info->dirty_bits / (info->total_bits?:1));
+			if (verbose > 0)
+				print_dirty_regions(info);
 		}
 	}
 
 free_info:
 	close(fd);
-	free(info);
+	bitmap_info_free(info);
+	return rv;
+}
+
+static int region_cmp(const void *av, const void *bv)
+{
+	const struct bitmap_region *a = av, *b = bv;
+
+	if (a->start < b->start)
+		return -1;
+	return a->start > b->start;
+}
+
+/* Add the dirty regions of one member's bitmap to 'rp' as ranges
+ * of sectors, each aligned to 'align' sectors.
+ */
+static void add_member_regions(bitmap_info_t *info, unsigned long long align,
+			       struct bitmap_region **rp, int *cntp)
+{
+	unsigned long long chunk = info->sb.chunksize >> 9;
+	int i;
+
+	*rp = xrealloc(*rp, sizeof(**rp) * (*cntp + info->nregions));
+	for (i = 0; i < info->nregions; i++) {
+		struct bitmap_region *r = &(*rp)[(*cntp)++];
+		unsigned long long end;
+
+		r->start = info->regions[i].start * chunk;
+		end = r->start + info->regions[i].count * chunk;
+		if (end > info->sb.sync_size)
+			end = info->sb.sync_size;
+		r->start -= r->start % align;
+		end = ROUND_UP(end, align);
+		r->count = end - r->start;
+	}
+}
+
+/* Sort regions and merge any that overlap or touch */
+static int merge_regions(struct bitmap_region *r, int cnt)
+{
+	int i, n = 0;
+
+	if (!cnt)
+		return 0;
+	qsort(r, cnt, sizeof(*r), region_cmp);
+	for (i = 1; i < cnt; i++) {
+		if (r[i].start <= r[n].start + r[n].count) {
+			unsigned long long end = r[i].start + r[i].count;
+
+			if (end > r[n].start + r[n].count)
+				r[n].count = end - r[n].start;
+		} else
+			r[++n] = r[i];
+	}
+	return n + 1;
+}
+
+/* Run a 'check' over sectors start..end and wait for it to get there.
+ * Returns the mismatch count, or -1 if the check could not be run.
+ */
+static long long check_window(struct mdinfo *sra, unsigned long long start,
+			      unsigned long long end)
+{
+	char action[SYSFS_MAX_BUF_SIZE];
+	unsigned long long completed, mismatches;
+	bool running = false;
+	int fd;
+
+	/* the kernel wants sync_min <= sync_max at every step, and sync_max
+	 * still holds the end of the previous window
+	 */
+	if (sysfs_set_str(sra, NULL, "sync_max", "max") < 0 ||
+	    sysfs_set_num(sra, NULL, "sync_min", start) < 0 ||
+	    sysfs_set_num(sra, NULL, "sync_max", end) < 0 ||
+	    sysfs_set_str(sra, NULL, "sync_action", "check") < 0)
+		return -1;
+
+	fd = sysfs_get_fd(sra, NULL, "sync_completed");
+	while (fd >= 0) {
+		int delay = 1000;
+		int rv = sysfs_fd_get_ll(fd, &completed);
+
+		if (rv == -2)
+			break;
+		if (rv == 0) {
+			running = true;
+			if (completed >= end)
+				break;
+		} else if (running) {
+			/* 'none' once a running check has finished */
+			break;
+		}
+		/* 'none' is also shown until the sync thread has started,
+		 * keep waiting while the check is still requested
+		 */
+		if (sysfs_get_str(sra, NULL, "sync_action", action,
+				  sizeof(action)) <= 0 ||
+		    strncmp(action, "check", 5) != 0)
+			break;
+		sysfs_wait(fd, &delay);
+	}
+	close_fd(&fd);
+
+	/* mismatch_cnt is only meaningful until the next check starts */
+	if (sysfs_get_ll(sra, NULL, "mismatch_cnt", &mismatches) < 0)
+		mismatches = 0;
+	sysfs_set_str(sra, NULL, "sync_action", "idle");
+	return mismatches;
+}
+
+int CheckDirtyRegions(char *dev, struct context *c)
+{
+	/*
+	 * Read the write-intent bitmap from every member of the array,
+	 * merge the dirty regions, and run a 'check' over only those,
+	 * using sync_min/sync_max to bound each pass.
+	 * With --test, just report the windows that would be checked.
+	 */
+	struct bitmap_region *regions = NULL;
+	struct supertype *array_st;
+	char action[SYSFS_MAX_BUF_SIZE];
+	char *subarray = NULL;
+	unsigned long long align = 1;
+	long long mismatches = 0;
+	struct mdinfo *sra, *sd;
+	int cnt = 0, members = 0;
+	int fd, i;
+	int rv = 1;
+
+	fd = open_mddev(dev, 1);
+	if (fd < 0)
+		return 1;
+	sra = sysfs_read(fd, NULL, GET_VERSION | GET_LEVEL | GET_CHUNK |
+			 GET_DEVS | GET_BITMAP_LOCATION);
+	/* members of a container carry the metadata of every subarray,
+	 * so the bitmap must be located for this one
+	 */
+	array_st = super_by_fd(fd, &subarray);
+	close(fd);
+	if (!sra) {
+		pr_err("%s is not an md array\n", dev);
+		free(array_st);
+		free(subarray);
+		return 1;
+	}
+	if (sra->bitmap_offset == 0) {
+		pr_err("%s does not have a write-intent bitmap\n", dev);
+		goto out;
+	}
+	if (sra->array.chunk_size > 0)
+		align = sra->array.chunk_size >> 9;
+
+	for (sd = sra->devs; sd; sd = sd->next) {
+		struct supertype *st = dup_super(array_st);
+		bitmap_info_t *info;
+		char *dname;
+		int mfd;
+
+		if (sd->disk.raid_disk < 0)
+			continue;
+		dname = map_dev(sd->disk.major, sd->disk.minor, 1);
+		if (!dname) {
+			free(st);
+			continue;
+		}
+		if (st && subarray)
+			snprintf(st->subarray, sizeof(st->subarray), "%s", subarray);
+		mfd = bitmap_file_open(dname, &st, 0, -1);
+		if (mfd < 0) {
+			free(st);
+			continue;
+		}
+		info = bitmap_fd_read(mfd, 0, 1);
+		close(mfd);
+		if (st) {
+			st->ss->free_super(st);
+			free(st);
+		}
+		if (!info)
+			continue;
+		if (info->sb.magic != BITMAP_MAGIC || info->sb.chunksize < 512) {
+			pr_err("no valid bitmap found on %s\n", dname);
+			bitmap_info_free(info);
+			continue;
+		}
+		add_member_regions(info, align, &regions, &cnt);
+		bitmap_info_free(info);
+		members++;
+	}
+	if (!members) {
+		pr_err("could not read a bitmap from any member of %s\n", dev);
+		goto out;
+	}
+	cnt = merge_regions(regions, cnt);
+
+	if (c->test) {
+		for (i = 0; i < cnt; i++)
+			printf("sync_min=%llu sync_max=%llu\n", regions[i].start,
+			       regions[i].start + regions[i].count);
+		rv = 0;
+		goto out;
+	}
+
+	if (sysfs_get_str(sra, NULL, "sync_action", action,
+			  sizeof(action)) <= 0 ||
+	    strncmp(action, "idle", 4) != 0) {
+		pr_err("%s is not idle, cannot start a check\n", dev);
+		goto out;
+	}
+
+	rv = 0;
+	for (i = 0; i < cnt; i++) {
+		unsigned long long end = regions[i].start + regions[i].count;
+		long long m;
+
+		if (c->verbose > 0)
+			pr_err("checking %s sectors %llu to %llu\n",
+			       dev, regions[i].start, end);
+		m = check_window(sra, regions[i].start, end);
+		if (m < 0) {
+			pr_err("failed to start check of %s: %s\n",
+			       dev, strerror(errno));
+			rv = 1;
+			break;
+		}
+		mismatches += m;
+	}
+	sysfs_set_num(sra, NULL, "sync_min", 0);
+	sysfs_set_str(sra, NULL, "sync_max", "max");
+
+	if (c->verbose >= 0)
+		printf("%s: checked %d dirty region%s, %lld mismatched sectors\n",
+		       dev, i, i == 1 ? "" : "s", mismatches);
+out:
+	free(regions);
+	sysfs_free(sra);
+	free(array_st);
+	free(subarray);
 	return rv;
 }
 
@@ -393,7 +711,7 @@ int IsBitmapDirty(char *filename)
 	if (fd < 0)
 		goto out;
 
-	info = bitmap_fd_read(fd, 0);
+	info = bitmap_fd_read(fd, 0, 0);
 	if (!info) {
 		close(fd);
 		goto out;
@@ -410,7 +728,7 @@ int IsBitmapDirty(char *filename)
 		if (fd < 0)
 			goto out;
 
-		info = bitmap_fd_read(fd, 0);
+		info = bitmap_fd_read(fd, 0, 0);
 		if (!info) {
 			close(fd);
 			goto out;
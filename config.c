@@ -501,38 +501,58 @@ void devline(char *line)
 struct mddev_ident *mddevlist = NULL;
 struct mddev_ident **mddevlp = &mddevlist;
 
+/* Problems reported while parsing ARRAY lines.  Only lines that parsed
+ * cleanly are kept in compiled form by the config cache, so that any
+ * complaint is repeated each time the config is read.
+ */
+static int conf_errors;
+#define conf_err(fmt, args...) \
+	do { conf_errors++; pr_err(fmt, ##args); } while (0)
+
+static void conf_add_ident(struct mddev_ident *mis)
+{
+	struct mddev_ident *mi;
+
+	mi = xmalloc(sizeof(*mi));
+	*mi = *mis;
+	mi->devname = mis->devname ? xstrdup(mis->devname) : NULL;
+	mi->next = NULL;
+	*mddevlp = mi;
+	mddevlp = &mi->next;
+}
+
 void arrayline(char *line)
 {
 	char *w;
 
 	struct mddev_ident mis;
-	struct mddev_ident *mi;
 
 	ident_init(&mis);
 
 	for (w = dl_next(line); w != line; w = dl_next(w)) {
 		if (w[0] == '/' || strchr(w, '=') == NULL) {
-			_ident_set_devname(&mis, w, false);
+			if (_ident_set_devname(&mis, w, false))
+				conf_errors++;
 		} else if (strncasecmp(w, "uuid=", 5) == 0) {
 			if (mis.uuid_set)
-				pr_err("only specify uuid once, %s ignored.\n",
+				conf_err("only specify uuid once, %s ignored.\n",
 				       w);
 			else {
 				if (parse_uuid(w + 5, mis.uuid))
 					mis.uuid_set = 1;
 				else
-					pr_err("bad uuid: %s\n", w);
+					conf_err("bad uuid: %s\n", w);
 			}
 		} else if (strncasecmp(w, "super-minor=", 12) == 0) {
 			if (mis.super_minor != UnSet)
-				pr_err("only specify super-minor once, %s ignored.\n",
+				conf_err("only specify super-minor once, %s ignored.\n",
 					w);
 			else {
 				char *endptr;
 				int minor = strtol(w + 12, &endptr, 10);
 
 				if (w[12] == 0 || endptr[0] != 0 || minor < 0)
-					pr_err("invalid super-minor number: %s\n",
+					conf_err("invalid super-minor number: %s\n",
 					       w);
 				else
 					mis.super_minor = minor;
@@ -542,7 +562,7 @@ void arrayline(char *line)
 			continue;
 		} else if (strncasecmp(w, "bitmap=", 7) == 0) {
 			if (mis.btype != BitmapUnknown)
-				pr_err("only specify bitmap file once. %s ignored\n",
+				conf_err("only specify bitmap file once. %s ignored\n",
 					w);
 			else {
 				char *bname = xstrdup(w + 7);
@@ -557,13 +577,13 @@ void arrayline(char *line)
 
 		} else if (strncasecmp(w, "devices=", 8 ) == 0) {
 			if (mis.devices)
-				pr_err("only specify devices once (use a comma separated list). %s ignored\n",
+				conf_err("only specify devices once (use a comma separated list). %s ignored\n",
 					w);
 			else
 				mis.devices = xstrdup(w + 8);
 		} else if (strncasecmp(w, "spare-group=", 12) == 0) {
 			if (mis.spare_group)
-				pr_err("only specify one spare group per array. %s ignored.\n",
+				conf_err("only specify one spare group per array. %s ignored.\n",
 					w);
 			else
 				mis.spare_group = xstrdup(w + 12);
@@ -588,7 +608,7 @@ void arrayline(char *line)
 					match_metadata_desc(w + 9);
 
 			if (!mis.st)
-				pr_err("metadata format %s unknown, ignored.\n",
+				conf_err("metadata format %s unknown, ignored.\n",
 				       w + 9);
 		} else if (strncasecmp(w, "auto=", 5) == 0) {
 			/* Ignore for backward compatibility */
@@ -601,23 +621,17 @@ void arrayline(char *line)
 			 * Either a device name or a uuid */
 			mis.container = xstrdup(w + 10);
 		} else {
-			pr_err("unrecognised word on ARRAY line: %s\n",
+			conf_err("unrecognised word on ARRAY line: %s\n",
 				w);
 		}
 	}
 	if (mis.uuid_set == 0 && mis.devices == NULL &&
 	    mis.super_minor == UnSet && mis.name[0] == 0 &&
 	    (mis.container == NULL || mis.member == NULL))
-		pr_err("ARRAY line %s has no identity information.\n",
+		conf_err("ARRAY line %s has no identity information.\n",
 		       mis.devname);
-	else {
-		mi = xmalloc(sizeof(*mi));
-		*mi = mis;
-		mi->devname = mis.devname ? xstrdup(mis.devname) : NULL;
-		mi->next = NULL;
-		*mddevlp = mi;
-		mddevlp = &mi->next;
-	}
+	else
+		conf_add_ident(&mis);
 }
 
 static char *alert_email = NULL;
@@ -856,60 +870,501 @@ void set_conffile(char *file)
 	conffile = file;
 }
 
+/*
+ * Compiled config cache.
+ *
+ * Every mdadm run (one per udev event with -I) parses the whole config,
+ * which is measurable with thousands of ARRAY lines.  When the default
+ * config is used, the parsed result is kept in MAP_DIR: ARRAY lines that
+ * parsed cleanly are stored as the resulting ident, every other line as
+ * its words, which are replayed through the usual handlers so that
+ * anything depending on the environment or reporting a problem still
+ * does so.  The cache is tagged with the mdadm version and the identity
+ * and timestamps of every file and directory that was read, or was
+ * looked for and not found; any change there makes the next run parse
+ * the config again.
+ */
+#define CONF_CACHE		MAP_DIR "/mdadm.conf.cache"
+#define CONF_CACHE_MAGIC	"MDCONF01"
+#define CONF_CACHE_MAX		(64 * 1024 * 1024)
+
+unsigned long crc32(
+	unsigned long crc,
+	const unsigned char *buf,
+	unsigned len);
+
+/* csum covers everything after the header */
+struct conf_cache_hdr {
+	char magic[8];
+	char version[80];
+	__u32 ninputs;
+	__u32 nrecords;
+	__u32 csum;
+};
+
+/* followed by path_len bytes of path */
+struct conf_cache_input {
+	__u64 dev;
+	__u64 ino;
+	__u64 size;
+	__s64 mtime_sec;
+	__s64 mtime_nsec;
+	__s64 ctime_sec;
+	__s64 ctime_nsec;
+	__u32 missing;
+	__u32 path_len;
+};
+
+/* an ARRAY line; followed by the strings devname, devices, metadata,
+ * spare_group, container and member
+ */
+struct conf_cache_array {
+	__s32 uuid_set;
+	__s32 uuid[4];
+	__s32 super_minor;
+	__s32 level;
+	__s32 raid_disks;
+	__s32 spare_disks;
+	__s32 btype;
+};
+
+enum conf_cache_rec { ConfCacheLine = 'L', ConfCacheArray = 'A' };
+
+struct conf_buf {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+static int conf_cache_building;
+static struct conf_buf conf_cache_inputs;
+static struct conf_buf conf_cache_records;
+static __u32 conf_cache_ninputs;
+static __u32 conf_cache_nrecords;
+
+static void conf_buf_put(struct conf_buf *b, const void *data, size_t len)
+{
+	if (b->len + len > b->size) {
+		b->size = (b->len + len) * 2;
+		b->data = xrealloc(b->data, b->size);
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+static void conf_buf_put_str(struct conf_buf *b, const char *str)
+{
+	/* NULL is stored as an all-ones length */
+	__u32 len = str ? strlen(str) : ~0U;
+
+	conf_buf_put(b, &len, sizeof(len));
+	if (str)
+		conf_buf_put(b, str, len);
+}
+
+static int conf_buf_get(char **p, char *end, void *data, size_t len)
+{
+	if ((size_t)(end - *p) < len)
+		return -1;
+	memcpy(data, *p, len);
+	*p += len;
+	return 0;
+}
+
+static int conf_buf_get_str(char **p, char *end, char **str)
+{
+	__u32 len;
+
+	*str = NULL;
+	if (conf_buf_get(p, end, &len, sizeof(len)) != 0)
+		return -1;
+	if (len == ~0U)
+		return 0;
+	if ((size_t)(end - *p) < len)
+		return -1;
+	*str = xmalloc(len + 1);
+	memcpy(*str, *p, len);
+	(*str)[len] = '\0';
+	*p += len;
+	return 0;
+}
+
+static void conf_cache_input(struct conf_cache_input *in, struct stat *stb)
+{
+	memset(in, 0, sizeof(*in));
+	if (!stb) {
+		in->missing = 1;
+		return;
+	}
+	in->dev = stb->st_dev;
+	in->ino = stb->st_ino;
+	in->size = stb->st_size;
+	in->mtime_sec = stb->st_mtim.tv_sec;
+	in->mtime_nsec = stb->st_mtim.tv_nsec;
+	in->ctime_sec = stb->st_ctim.tv_sec;
+	in->ctime_nsec = stb->st_ctim.tv_nsec;
+}
+
+/* Record that 'dir/name' (or 'name' if dir is NULL) was read through
+ * 'fd', or looked for and not found if 'fd' is -1.
+ */
+static void conf_cache_note(const char *dir, const char *name, int fd)
+{
+	struct conf_cache_input in;
+	struct stat stb;
+	char *path = NULL;
+
+	if (!conf_cache_building)
+		return;
+	if (fd >= 0 && fstat(fd, &stb) != 0) {
+		conf_cache_building = 0;
+		return;
+	}
+	conf_cache_input(&in, fd >= 0 ? &stb : NULL);
+	if (dir)
+		xasprintf(&path, "%s/%s", dir, name);
+	else
+		path = xstrdup(name);
+	in.path_len = strlen(path);
+	conf_buf_put(&conf_cache_inputs, &in, sizeof(in));
+	conf_buf_put(&conf_cache_inputs, path, in.path_len);
+	conf_cache_ninputs++;
+	free(path);
+}
+
+static void conf_cache_line(char *line)
+{
+	char rec = ConfCacheLine;
+	__u32 nwords = 1;
+	char *w;
+
+	for (w = dl_next(line); w != line; w = dl_next(w))
+		nwords++;
+	conf_buf_put(&conf_cache_records, &rec, 1);
+	conf_buf_put(&conf_cache_records, &nwords, sizeof(nwords));
+	conf_buf_put_str(&conf_cache_records, line);
+	for (w = dl_next(line); w != line; w = dl_next(w))
+		conf_buf_put_str(&conf_cache_records, w);
+	conf_cache_nrecords++;
+}
+
+static void conf_cache_array(char *line, struct mddev_ident *mi)
+{
+	struct conf_cache_array a = {
+		.uuid_set = mi->uuid_set,
+		.super_minor = mi->super_minor,
+		.level = mi->level,
+		.raid_disks = mi->raid_disks,
+		.spare_disks = mi->spare_disks,
+		.btype = mi->btype,
+	};
+	char rec = ConfCacheArray;
+	char *metadata = NULL;
+	char *w;
+
+	memcpy(a.uuid, mi->uuid, sizeof(a.uuid));
+	/* arrayline() uses the first metadata= word */
+	for (w = dl_next(line); w != line && !metadata; w = dl_next(w))
+		if (strncasecmp(w, "metadata=", 9) == 0)
+			metadata = w + 9;
+
+	conf_buf_put(&conf_cache_records, &rec, 1);
+	conf_buf_put(&conf_cache_records, &a, sizeof(a));
+	conf_buf_put_str(&conf_cache_records, mi->devname);
+	conf_buf_put_str(&conf_cache_records, mi->devices);
+	conf_buf_put_str(&conf_cache_records, metadata);
+	conf_buf_put_str(&conf_cache_records, mi->spare_group);
+	conf_buf_put_str(&conf_cache_records, mi->container);
+	conf_buf_put_str(&conf_cache_records, mi->member);
+	conf_cache_nrecords++;
+}
+
+static int conf_cache_valid(struct conf_cache_input *in, char *path)
+{
+	struct conf_cache_input now;
+	struct stat stb;
+
+	if (stat(path, &stb) != 0)
+		return in->missing && errno == ENOENT;
+	if (in->missing)
+		return 0;
+	conf_cache_input(&now, &stb);
+	now.path_len = in->path_len;
+	return memcmp(&now, in, sizeof(now)) == 0;
+}
+
+static void conf_dispatch(char *line);
+
+static int conf_cache_load_array(char **p, char *end)
+{
+	struct conf_cache_array a;
+	struct mddev_ident mis;
+	char *metadata = NULL;
+	int i, err;
+
+	if (conf_buf_get(p, end, &a, sizeof(a)) != 0)
+		return -1;
+	ident_init(&mis);
+	mis.uuid_set = a.uuid_set;
+	memcpy(mis.uuid, a.uuid, sizeof(mis.uuid));
+	mis.super_minor = a.super_minor;
+	mis.level = a.level;
+	mis.raid_disks = a.raid_disks;
+	mis.spare_disks = a.spare_disks;
+	mis.btype = a.btype;
+	err = conf_buf_get_str(p, end, &mis.devname) ||
+		conf_buf_get_str(p, end, &mis.devices) ||
+		conf_buf_get_str(p, end, &metadata) ||
+		conf_buf_get_str(p, end, &mis.spare_group) ||
+		conf_buf_get_str(p, end, &mis.container) ||
+		conf_buf_get_str(p, end, &mis.member);
+	if (!err && metadata)
+		for (i = 0; superlist[i] && !mis.st; i++)
+			mis.st = superlist[i]->match_metadata_desc(metadata);
+	free(metadata);
+	if (err)
+		return -1;
+	conf_add_ident(&mis);
+	free(mis.devname);
+	return 0;
+}
+
+static int conf_cache_load_line(char **p, char *end)
+{
+	char *line = NULL;
+	__u32 nwords, i;
+	char *w;
+
+	if (conf_buf_get(p, end, &nwords, sizeof(nwords)) != 0 || nwords == 0)
+		return -1;
+	for (i = 0; i < nwords; i++) {
+		char *d;
+
+		if (conf_buf_get_str(p, end, &w) != 0 || !w) {
+			free(w);
+			if (line)
+				free_line(line);
+			return -1;
+		}
+		d = dl_strdup(w);
+		free(w);
+		if (line)
+			dl_add(line, d);
+		else {
+			line = d;
+			dl_init(line);
+		}
+	}
+	conf_dispatch(line);
+	free_line(line);
+	return 0;
+}
+
+static int conf_cache_load(void)
+{
+	struct conf_cache_hdr hdr;
+	struct stat stb;
+	char *buf, *p, *end;
+	__u32 i;
+	int fd;
+
+	fd = open(CONF_CACHE, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &stb) != 0 || stb.st_size < (off_t)sizeof(hdr) ||
+	    stb.st_size > CONF_CACHE_MAX) {
+		close(fd);
+		return 0;
+	}
+	buf = xmalloc(stb.st_size);
+	if (read(fd, buf, stb.st_size) != stb.st_size) {
+		close(fd);
+		free(buf);
+		return 0;
+	}
+	close(fd);
+
+	p = buf;
+	end = buf + stb.st_size;
+	conf_buf_get(&p, end, &hdr, sizeof(hdr));
+	if (memcmp(hdr.magic, CONF_CACHE_MAGIC, sizeof(hdr.magic)) ||
+	    strncmp(hdr.version, Version, sizeof(hdr.version) - 1) ||
+	    hdr.csum != crc32(0, (unsigned char *)p, end - p))
+		goto fail;
+
+	for (i = 0; i < hdr.ninputs; i++) {
+		struct conf_cache_input in;
+		char *path;
+		int ok;
+
+		if (conf_buf_get(&p, end, &in, sizeof(in)) != 0 ||
+		    in.path_len > (size_t)(end - p))
+			goto fail;
+		path = xmalloc(in.path_len + 1);
+		memcpy(path, p, in.path_len);
+		path[in.path_len] = '\0';
+		p += in.path_len;
+		ok = conf_cache_valid(&in, path);
+		free(path);
+		if (!ok)
+			goto fail;
+	}
+
+	/* The checksum matched, so the records are as a complete run
+	 * wrote them.
+	 */
+	for (i = 0; i < hdr.nrecords; i++) {
+		char rec;
+		int err;
+
+		if (conf_buf_get(&p, end, &rec, 1) != 0)
+			break;
+		if (rec == ConfCacheArray)
+			err = conf_cache_load_array(&p, end);
+		else if (rec == ConfCacheLine)
+			err = conf_cache_load_line(&p, end);
+		else
+			err = -1;
+		if (err)
+			break;
+	}
+	free(buf);
+	return 1;
+fail:
+	free(buf);
+	return 0;
+}
+
+static void conf_cache_save(void)
+{
+	char tmp[] = CONF_CACHE ".XXXXXX";
+	struct conf_cache_hdr hdr;
+	int fd, ok;
+
+	if (!conf_cache_building)
+		goto out;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CONF_CACHE_MAGIC, sizeof(hdr.magic));
+	strncpy(hdr.version, Version, sizeof(hdr.version) - 1);
+	hdr.ninputs = conf_cache_ninputs;
+	hdr.nrecords = conf_cache_nrecords;
+	hdr.csum = crc32(0, (unsigned char *)conf_cache_inputs.data,
+			 conf_cache_inputs.len);
+	hdr.csum = crc32(hdr.csum, (unsigned char *)conf_cache_records.data,
+			 conf_cache_records.len);
+
+	/* a private temporary file, concurrent runs may be saving too */
+	(void)mkdir(MAP_DIR, 0755);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto out;
+	ok = fchmod(fd, 0644) == 0 &&
+		write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+		write(fd, conf_cache_inputs.data, conf_cache_inputs.len) ==
+		(ssize_t)conf_cache_inputs.len &&
+		write(fd, conf_cache_records.data, conf_cache_records.len) ==
+		(ssize_t)conf_cache_records.len;
+	if (close(fd) != 0)
+		ok = 0;
+	if (!ok || rename(tmp, CONF_CACHE) != 0)
+		unlink(tmp);
+out:
+	conf_cache_building = 0;
+	free(conf_cache_inputs.data);
+	free(conf_cache_records.data);
+	memset(&conf_cache_inputs, 0, sizeof(conf_cache_inputs));
+	memset(&conf_cache_records, 0, sizeof(conf_cache_records));
+}
+
+static void conf_dispatch(char *line)
+{
+	switch(match_keyword(line)) {
+	case Devices:
+		devline(line);
+		break;
+	case Array:
+		arrayline(line);
+		break;
+	case Mailaddr:
+		mailline(line);
+		break;
+	case Mailfrom:
+		mailfromline(line);
+		break;
+	case Program:
+		programline(line);
+		break;
+	case CreateDev:
+		createline(line);
+		break;
+	case Homehost:
+		homehostline(line);
+		break;
+	case HomeCluster:
+		homeclusterline(line);
+		break;
+	case AutoMode:
+		autoline(line);
+		break;
+	case Policy:
+		policyline(line, rule_policy);
+		break;
+	case PartPolicy:
+		policyline(line, rule_part);
+		break;
+	case Sysfs:
+		sysfsline(line);
+		break;
+	case MonitorDelay:
+		monitordelayline(line);
+		break;
+	case EncryptionNoVerify:
+		encryption_no_verify_line(line);
+		break;
+	default:
+		pr_err("Unknown keyword %s\n", line);
+	}
+}
+
 void conf_file(FILE *f)
 {
 	char *line;
 	while ((line = conf_line(f))) {
-		switch(match_keyword(line)) {
-		case Devices:
-			devline(line);
-			break;
-		case Array:
+		if (conf_cache_building && match_keyword(line) == Array) {
+			struct mddev_ident **tail = mddevlp;
+			int errors = conf_errors;
+
 			arrayline(line);
-			break;
-		case Mailaddr:
-			mailline(line);
-			break;
-		case Mailfrom:
-			mailfromline(line);
-			break;
-		case Program:
-			programline(line);
-			break;
-		case CreateDev:
-			createline(line);
-			break;
-		case Homehost:
-			homehostline(line);
-			break;
-		case HomeCluster:
-			homeclusterline(line);
-			break;
-		case AutoMode:
-			autoline(line);
-			break;
-		case Policy:
-			policyline(line, rule_policy);
-			break;
-		case PartPolicy:
-			policyline(line, rule_part);
-			break;
-		case Sysfs:
-			sysfsline(line);
-			break;
-		case MonitorDelay:
-			monitordelayline(line);
-			break;
-		case EncryptionNoVerify:
-			encryption_no_verify_line(line);
-			break;
-		default:
-			pr_err("Unknown keyword %s\n", line);
+			if (conf_errors == errors && *tail)
+				conf_cache_array(line, *tail);
+			else
+				conf_cache_line(line);
+		} else {
+			/* record before dispatching: autoline() adds words */
+			if (conf_cache_building)
+				conf_cache_line(line);
+			conf_dispatch(line);
 		}
 		free_line(line);
 	}
 }
 
+/* directory whose entries conf_file_or_dir() is reading */
+static const char *conf_cache_dir;
+
+static FILE *conf_cache_open(const char *path)
+{
+	FILE *f = fopen(path, "r");
+
+	if (f || errno == ENOENT)
+		conf_cache_note(NULL, path, f ? fileno(f) : -1);
+	else
+		/* can't tell when this would change */
+		conf_cache_building = 0;
+	return f;
+}
+
 struct fname {
 	struct fname *next;
 	char name[];
@@ -957,6 +1412,8 @@ void conf_file_or_dir(FILE *f)
 		struct fname *fn = list;
 		list = list->next;
 		fd = openat(fileno(f), fn->name, O_RDONLY);
+		if (fd >= 0)
+			conf_cache_note(conf_cache_dir, fn->name, fd);
 		free(fn);
 		if (fd < 0)
 			continue;
@@ -983,6 +1440,11 @@ void load_conffile(void)
 	if (conffile == NULL) {
 		conffile = DefaultConfFile;
 		confdir = DefaultConfDir;
+		if (!check_env("MDADM_NO_CONF_CACHE")) {
+			if (conf_cache_load())
+				goto done;
+			conf_cache_building = 1;
+		}
 	}
 
 	if (strcmp(conffile, "partitions") == 0) {
@@ -992,31 +1454,35 @@ void load_conffile(void)
 		devline(list);
 		free_line(list);
 	} else if (str_is_none(conffile) == false) {
-		f = fopen(conffile, "r");
+		f = conf_cache_open(conffile);
 		/* Debian chose to relocate mdadm.conf into /etc/mdadm/.
 		 * To allow Debian users to compile from clean source and still
 		 * have a working mdadm, we read /etc/mdadm/mdadm.conf
 		 * if /etc/mdadm.conf doesn't exist
 		 */
 		if (f == NULL && conffile == DefaultConfFile) {
-			f = fopen(DefaultAltConfFile, "r");
+			f = conf_cache_open(DefaultAltConfFile);
 			if (f) {
 				conffile = DefaultAltConfFile;
 				confdir = DefaultAltConfDir;
 			}
 		}
 		if (f) {
+			conf_cache_dir = conffile;
 			conf_file_or_dir(f);
 			fclose(f);
 		}
 		if (confdir) {
-			f = fopen(confdir, "r");
+			f = conf_cache_open(confdir);
 			if (f) {
+				conf_cache_dir = confdir;
 				conf_file_or_dir(f);
 				fclose(f);
 			}
 		}
+		conf_cache_save();
 	}
+done:
 	/* If there was no AUTO line, process an empty line
 	 * now so that the MDADM_CONF_AUTO env var gets processed.
 	 */
@@ -1078,15 +1544,144 @@ struct createinfo *conf_get_create_info(void)
 	return &createinfo;
 }
 
+/*
+ * With thousands of ARRAY lines, walking mddevlist for every lookup adds
+ * up, so it is indexed on first use: by uuid, and by the forms of
+ * devname, name and super-minor that devname_matches() compares.  Hash
+ * chains keep the order of mddevlist so the first match is still the
+ * first in the config.
+ */
+struct conf_index {
+	int count;
+	unsigned int mask;
+	struct mddev_ident **list;
+	int *uuid_head, *uuid_next;
+	int *dev_head, *dev_next;
+	/* devname, name and super-minor of entry i are keys 3i to 3i+2 */
+	char **keys;
+	int *key_head, *key_next;
+	/* entries without a uuid, in order */
+	int *plain;
+	int nplain;
+};
+
+static struct conf_index *conf_index;
+
+static char *devname_base(char *name)
+{
+	if (strncmp(name, DEV_MD_DIR, DEV_MD_DIR_LEN) == 0)
+		name += DEV_MD_DIR_LEN;
+	else if (strncmp(name, "/dev/", 5) == 0)
+		name += 5;
+	if (strncmp(name, "md", 2) == 0 && isdigit(name[2]))
+		name += 2;
+	return name;
+}
+
+static unsigned int conf_hash(const void *data, size_t len)
+{
+	const unsigned char *c = data;
+	unsigned int h = 2166136261U;
+
+	while (len--)
+		h = (h ^ *c++) * 16777619U;
+	return h;
+}
+
+static unsigned int conf_hash_uuid(int uuid[4])
+{
+	return conf_hash(uuid, 4 * sizeof(int));
+}
+
+static void conf_index_push(int *head, int *next, unsigned int bucket, int i)
+{
+	next[i] = head[bucket];
+	head[bucket] = i;
+}
+
+static struct conf_index *conf_get_index(void)
+{
+	struct conf_index *ci;
+	struct mddev_ident *mi;
+	unsigned int size = 16;
+	int i, k;
+
+	load_conffile();
+	if (conf_index)
+		return conf_index;
+
+	ci = xcalloc(1, sizeof(*ci));
+	for (mi = mddevlist; mi; mi = mi->next)
+		ci->count++;
+	while (size < 2 * (unsigned int)ci->count)
+		size *= 2;
+	ci->mask = size - 1;
+	ci->list = xcalloc(ci->count + 1, sizeof(*ci->list));
+	ci->uuid_head = xmalloc(size * sizeof(int));
+	ci->dev_head = xmalloc(size * sizeof(int));
+	ci->key_head = xmalloc(size * sizeof(int));
+	memset(ci->uuid_head, -1, size * sizeof(int));
+	memset(ci->dev_head, -1, size * sizeof(int));
+	memset(ci->key_head, -1, size * sizeof(int));
+	ci->uuid_next = xcalloc(ci->count + 1, sizeof(int));
+	ci->dev_next = xcalloc(ci->count + 1, sizeof(int));
+	ci->keys = xcalloc(3 * ci->count + 1, sizeof(char *));
+	ci->key_next = xcalloc(3 * ci->count + 1, sizeof(int));
+	ci->plain = xcalloc(ci->count + 1, sizeof(int));
+
+	for (i = 0, mi = mddevlist; mi; mi = mi->next, i++)
+		ci->list[i] = mi;
+	for (i = 0; i < ci->count; i++)
+		if (!ci->list[i]->uuid_set)
+			ci->plain[ci->nplain++] = i;
+	/* walk backwards so that each chain ends up in config order */
+	for (i = ci->count - 1; i >= 0; i--) {
+		char nbuf[20];
+
+		mi = ci->list[i];
+		if (mi->uuid_set)
+			conf_index_push(ci->uuid_head, ci->uuid_next,
+					conf_hash_uuid(mi->uuid) & ci->mask, i);
+		if (mi->devname) {
+			char *b = devname_base(mi->devname);
+
+			conf_index_push(ci->dev_head, ci->dev_next,
+					conf_hash(b, strlen(b)) & ci->mask, i);
+			ci->keys[3 * i] = b;
+		}
+		if (mi->name[0])
+			ci->keys[3 * i + 1] = devname_base(mi->name);
+		if (mi->super_minor != UnSet) {
+			snprintf(nbuf, sizeof(nbuf), "%d", mi->super_minor);
+			ci->keys[3 * i + 2] = xstrdup(devname_base(nbuf));
+		}
+		for (k = 3 * i; k < 3 * i + 3; k++)
+			if (ci->keys[k])
+				conf_index_push(ci->key_head, ci->key_next,
+						conf_hash(ci->keys[k],
+							  strlen(ci->keys[k])) &
+						ci->mask, k);
+	}
+	conf_index = ci;
+	return ci;
+}
+
 struct mddev_ident *conf_get_ident(char *dev)
 {
-	struct mddev_ident *rv;
+	struct conf_index *ci;
+	char *b;
+	int i;
+
 	load_conffile();
-	rv = mddevlist;
-	while (dev && rv && (rv->devname == NULL ||
-			     !devname_matches(dev, rv->devname)))
-		rv = rv->next;
-	return rv;
+	if (!dev)
+		return mddevlist;
+	ci = conf_get_index();
+	b = devname_base(dev);
+	for (i = ci->dev_head[conf_hash(b, strlen(b)) & ci->mask]; i >= 0;
+	     i = ci->dev_next[i])
+		if (strcmp(b, devname_base(ci->list[i]->devname)) == 0)
+			return ci->list[i];
+	return NULL;
 }
 
 static void append_dlist(struct mddev_dev **dlp, struct mddev_dev *list)
@@ -1220,22 +1815,7 @@ int devname_matches(char *name, char *match)
 	 *  mdNN with NN
 	 * then just strcmp
 	 */
-	if (strncmp(name, DEV_MD_DIR, DEV_MD_DIR_LEN) == 0)
-		name += DEV_MD_DIR_LEN;
-	else if (strncmp(name, "/dev/", 5) == 0)
-		name += 5;
-
-	if (strncmp(match, DEV_MD_DIR, DEV_MD_DIR_LEN) == 0)
-		match += DEV_MD_DIR_LEN;
-	else if (strncmp(match, "/dev/", 5) == 0)
-		match += 5;
-
-	if (strncmp(name, "md", 2) == 0 && isdigit(name[2]))
-		name += 2;
-	if (strncmp(match, "md", 2) == 0 && isdigit(match[2]))
-		match += 2;
-
-	return (strcmp(name, match) == 0);
+	return strcmp(devname_base(name), devname_base(match)) == 0;
 }
 
 int conf_name_is_free(char *name)
@@ -1245,20 +1825,75 @@ int conf_name_is_free(char *name)
 	 * It can be taken either by a match on devname, name, or
 	 * even super-minor.
 	 */
+	struct conf_index *ci = conf_get_index();
+	char *b = devname_base(name);
+	int k;
+
+	for (k = ci->key_head[conf_hash(b, strlen(b)) & ci->mask]; k >= 0;
+	     k = ci->key_next[k])
+		if (strcmp(b, ci->keys[k]) == 0)
+			return 0;
+	return 1;
+}
+
+static void conf_mark_minor(unsigned long long *map, int bits, char *match)
+{
+	char name[32];
+	char *cp = match, *end;
+	long n;
+
+	if (strncmp(cp, DEV_MD_DIR, DEV_MD_DIR_LEN) == 0)
+		cp += DEV_MD_DIR_LEN;
+	else if (strncmp(cp, "/dev/", 5) == 0)
+		cp += 5;
+	if (strncmp(cp, "md", 2) == 0)
+		cp += 2;
+	if (!isdigit(*cp))
+		return;
+	n = strtol(cp, &end, 10);
+	if (*end || n >= bits)
+		return;
+	snprintf(name, sizeof(name), "md%ld", n);
+	if (devname_matches(name, match))
+		map[n / 64] |= 1ULL << (n % 64);
+}
+
+/* Set the bit for every mdN, N < @bits, that conf_name_is_free() would
+ * report as taken, so callers probing many names need only one pass.
+ */
+void conf_used_minors(unsigned long long *map, int bits)
+{
 	struct mddev_ident *dev;
+	char nbuf[100];
 
 	load_conffile();
 	for (dev = mddevlist; dev; dev = dev->next) {
-		char nbuf[100];
-		if (dev->devname && devname_matches(name, dev->devname))
-			return 0;
-		if (dev->name[0] && devname_matches(name, dev->name))
-			return 0;
-		sprintf(nbuf, "%d", dev->super_minor);
-		if (dev->super_minor != UnSet && devname_matches(name, nbuf))
-			return 0;
+		if (dev->devname)
+			conf_mark_minor(map, bits, dev->devname);
+		if (dev->name[0])
+			conf_mark_minor(map, bits, dev->name);
+		if (dev->super_minor != UnSet) {
+			sprintf(nbuf, "%d", dev->super_minor);
+			conf_mark_minor(map, bits, nbuf);
+		}
 	}
-	return 1;
+}
+
+static int conf_match_next(struct conf_index *ci, int all, int *u, int *p)
+{
+	/* Next entry to consider, in config order: all of them, or only
+	 * those on uuid chain 'u' and those without a uuid.
+	 */
+	int i;
+
+	if (all)
+		return *p < ci->count ? (*p)++ : -1;
+	if (*p < ci->nplain && (*u < 0 || ci->plain[*p] < *u))
+		return ci->plain[(*p)++];
+	i = *u;
+	if (i >= 0)
+		*u = ci->uuid_next[i];
+	return i;
 }
 
 struct mddev_ident *conf_match(struct supertype *st,
@@ -1267,9 +1902,21 @@ struct mddev_ident *conf_match(struct supertype *st,
 			       int verbose, int *rvp)
 {
 	struct mddev_ident *array_list, *match;
-	array_list = conf_get_ident(NULL);
+	struct conf_index *ci = conf_get_index();
+	/* with verbose >= 2 every entry must be visited, to report why */
+	int all = verbose >= 2;
+	int uuid[4];
+	int u, p = 0, i;
+
+	memcpy(uuid, info->uuid, sizeof(uuid));
+	if (st->ss->swapuuid)
+		for (i = 0; i < 4; i++)
+			uuid[i] = __builtin_bswap32(uuid[i]);
+	u = ci->uuid_head[conf_hash_uuid(uuid) & ci->mask];
+
 	match = NULL;
-	for (; array_list; array_list = array_list->next) {
+	while ((i = conf_match_next(ci, all, &u, &p)) >= 0) {
+		array_list = ci->list[i];
 		if (array_list->uuid_set &&
 		    same_uuid(array_list->uuid, info->uuid,
 			      st->ss->swapuuid) == 0) {
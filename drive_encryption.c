@@ -13,9 +13,30 @@
 #include <scsi/sg.h>
 #include <scsi/scsi.h>
 #include "drive_encryption.h"
+#include "xmalloc.h"
 
 #define DEFAULT_SECTOR_SIZE (512)
 
+/*
+ * Encryption information is memoized per disk, keyed by device number and
+ * disk sequence number.  The lock status changes when a drive is unlocked,
+ * so an entry only lives for ENCRYPTION_MEMO_MSEC: long enough to share one
+ * round of queries (e.g. a prefetch followed by the printing), short enough
+ * that a long-running mdadm --monitor sees the current state.
+ */
+#define ENCRYPTION_MEMO_MSEC 2000
+
+struct encryption_memo {
+	dev_t devid;
+	unsigned long long seq;
+	struct timespec time;
+	bool nvme;
+	encryption_information_t information;
+	struct encryption_memo *next;
+};
+
+static struct encryption_memo *encryption_memo;
+
 /*
  * Opal defines
  * TCG Storage Opal SSC 2.01 chapter 3.3.3
@@ -389,7 +410,7 @@ static mdadm_status_t get_opal_encryption_information(__u8 *buffer,
 }
 
 /**
- * get_nvme_opal_encryption_information() - get NVMe Opal encryption information.
+ * read_nvme_opal_encryption_information() - get NVMe Opal encryption information.
  * @disk_fd: a disk file descriptor.
  * @information: struct to fill out, describing encryption status of disk.
  * @verbose: verbose flag.
@@ -404,8 +425,8 @@ static mdadm_status_t get_opal_encryption_information(__u8 *buffer,
  *
  * %MDADM_STATUS_SUCCESS on success, %MDADM_STATUS_ERROR otherwise.
  */
-mdadm_status_t
-get_nvme_opal_encryption_information(int disk_fd, encryption_information_t *information,
+static mdadm_status_t
+read_nvme_opal_encryption_information(int disk_fd, encryption_information_t *information,
 				     const int verbose)
 {
 	__u8 buffer[OPAL_IO_BUFFER_LEN];
@@ -665,7 +686,7 @@ static drive_feat_sup_st is_ata_opal(int disk_fd, __u16 *buffer_identify, const
 }
 
 /**
- * get_ata_encryption_information() - get ATA disk encryption information.
+ * read_ata_encryption_information() - get ATA disk encryption information.
  * @disk_fd: a disk file descriptor.
  * @information: struct to fill out, describing encryption status of disk.
  * @verbose: verbose flag.
@@ -681,8 +702,8 @@ static drive_feat_sup_st is_ata_opal(int disk_fd, __u16 *buffer_identify, const
  *
  * Return: %MDADM_STATUS_SUCCESS on success, %MDADM_STATUS_ERROR on fail.
  */
-mdadm_status_t
-get_ata_encryption_information(int disk_fd, struct encryption_information *information,
+static mdadm_status_t
+read_ata_encryption_information(int disk_fd, struct encryption_information *information,
 			       const int verbose)
 {
 	__u8 buffer_opal_level0_discovery[OPAL_IO_BUFFER_LEN] = {0};
@@ -726,3 +747,111 @@ get_ata_encryption_information(int disk_fd, struct encryption_information *infor
 
 	return get_opal_encryption_information(buffer_opal_level0_discovery, information);
 }
+
+/**
+ * encryption_information_remember() - memoize encryption information of a disk.
+ * @devid: device number of the disk.
+ * @seq: disk sequence number of the disk.
+ * @nvme: true if @information comes from NVMe Opal discovery, false for ATA.
+ * @information: encryption information to remember.
+ *
+ * Lets a caller which queried disks out of process (see imsm_identify_prefetch())
+ * seed the memo consulted by get_nvme_opal_encryption_information() and
+ * get_ata_encryption_information().
+ */
+void encryption_information_remember(dev_t devid, unsigned long long seq, bool nvme,
+				     encryption_information_t *information)
+{
+	struct encryption_memo *memo;
+
+	for (memo = encryption_memo; memo; memo = memo->next)
+		if (memo->devid == devid && memo->nvme == nvme)
+			break;
+
+	if (!memo) {
+		memo = xmalloc(sizeof(*memo));
+		memo->devid = devid;
+		memo->nvme = nvme;
+		memo->next = encryption_memo;
+		encryption_memo = memo;
+	}
+
+	memo->seq = seq;
+	memo->information = *information;
+	clock_gettime(CLOCK_MONOTONIC, &memo->time);
+}
+
+static mdadm_status_t
+get_encryption_information(int disk_fd, encryption_information_t *information,
+			   const int verbose, bool nvme)
+{
+	struct encryption_memo *memo;
+	unsigned long long seq;
+	mdadm_status_t status;
+	struct timespec now;
+	dev_t devid;
+
+	if (!get_disk_identity(disk_fd, &devid, &seq)) {
+		/* Without a disk sequence number dev_t reuse can't be detected */
+		if (nvme)
+			return read_nvme_opal_encryption_information(disk_fd, information, verbose);
+		return read_ata_encryption_information(disk_fd, information, verbose);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (memo = encryption_memo; memo; memo = memo->next) {
+		if (memo->devid == devid && memo->seq == seq && memo->nvme == nvme &&
+		    (now.tv_sec - memo->time.tv_sec) * 1000 +
+		    (now.tv_nsec - memo->time.tv_nsec) / 1000000 < ENCRYPTION_MEMO_MSEC) {
+			*information = memo->information;
+			return MDADM_STATUS_SUCCESS;
+		}
+	}
+
+	if (nvme)
+		status = read_nvme_opal_encryption_information(disk_fd, information, verbose);
+	else
+		status = read_ata_encryption_information(disk_fd, information, verbose);
+
+	/* Failures are not remembered, they may be transient */
+	if (status == MDADM_STATUS_SUCCESS)
+		encryption_information_remember(devid, seq, nvme, information);
+
+	return status;
+}
+
+/**
+ * get_nvme_opal_encryption_information() - get NVMe Opal encryption information.
+ * @disk_fd: a disk file descriptor.
+ * @information: struct to fill out, describing encryption status of disk.
+ * @verbose: verbose flag.
+ *
+ * Memoized wrapper of read_nvme_opal_encryption_information(), a disk is not
+ * queried again for ENCRYPTION_MEMO_MSEC.
+ *
+ * Return: %MDADM_STATUS_SUCCESS on success, %MDADM_STATUS_ERROR otherwise.
+ */
+mdadm_status_t
+get_nvme_opal_encryption_information(int disk_fd, encryption_information_t *information,
+				     const int verbose)
+{
+	return get_encryption_information(disk_fd, information, verbose, true);
+}
+
+/**
+ * get_ata_encryption_information() - get ATA disk encryption information.
+ * @disk_fd: a disk file descriptor.
+ * @information: struct to fill out, describing encryption status of disk.
+ * @verbose: verbose flag.
+ *
+ * Memoized wrapper of read_ata_encryption_information(), a disk is not
+ * queried again for ENCRYPTION_MEMO_MSEC.
+ *
+ * Return: %MDADM_STATUS_SUCCESS on success, %MDADM_STATUS_ERROR otherwise.
+ */
+mdadm_status_t
+get_ata_encryption_information(int disk_fd, struct encryption_information *information,
+			       const int verbose)
+{
+	return get_encryption_information(disk_fd, information, verbose, false);
+}
@@ -223,21 +223,102 @@ struct metadata_update *update_queue = NULL;
 struct metadata_update *update_queue_handled = NULL;
 struct metadata_update *update_queue_pending = NULL;
 
+/* Updates that arrive over the socket are carried in slots from a small
+ * pool, so a steady stream of updates from mdadm does not allocate and
+ * free a header and payload each time.  Slots are only taken and released
+ * by the manager thread (the monitor just walks update_queue and hands the
+ * list back through update_queue_handled), so the pool needs no locking.
+ * Payload buffers are kept with the slot unless they grew unusually large.
+ */
+#define UPDATE_POOL_SIZE	16
+#define UPDATE_POOL_KEEP	(64 * 1024)
+
+struct update_slot {
+	struct metadata_update mu;	/* must be first */
+	int size;			/* bytes allocated at mu.buf */
+	struct update_slot *next_free;
+};
+
+static struct update_slot update_pool[UPDATE_POOL_SIZE];
+static struct update_slot *update_pool_free;
+static int update_pool_ready;
+
+static struct update_slot *pool_slot(struct metadata_update *mu)
+{
+	struct update_slot *slot = (struct update_slot *)mu;
+
+	if ((uintptr_t)slot < (uintptr_t)update_pool ||
+	    (uintptr_t)slot >= (uintptr_t)(update_pool + UPDATE_POOL_SIZE))
+		return NULL;
+	return slot;
+}
+
+static struct update_slot *get_update_slot(void)
+{
+	struct update_slot *slot;
+	int i;
+
+	if (!update_pool_ready) {
+		for (i = UPDATE_POOL_SIZE - 1; i >= 0; i--) {
+			update_pool[i].next_free = update_pool_free;
+			update_pool_free = &update_pool[i];
+		}
+		update_pool_ready = 1;
+	}
+
+	slot = update_pool_free;
+	if (slot) {
+		update_pool_free = slot->next_free;
+	} else {
+		/* pool exhausted: fall back to a one-off allocation */
+		slot = xmalloc(sizeof(*slot));
+		slot->mu.buf = NULL;
+		slot->size = 0;
+	}
+	slot->mu.len = 0;
+	slot->mu.space = NULL;
+	slot->mu.space_list = NULL;
+	slot->mu.next = NULL;
+	slot->next_free = NULL;
+	return slot;
+}
+
+static void put_update_slot(struct update_slot *slot)
+{
+	if (!pool_slot(&slot->mu)) {
+		free(slot->mu.buf);
+		free(slot);
+		return;
+	}
+	if (slot->size > UPDATE_POOL_KEEP) {
+		free(slot->mu.buf);
+		slot->mu.buf = NULL;
+		slot->size = 0;
+	}
+	slot->next_free = update_pool_free;
+	update_pool_free = slot;
+}
+
 static void free_updates(struct metadata_update **update)
 {
 	while (*update) {
 		struct metadata_update *this = *update;
 		void **space_list = this->space_list;
+		struct update_slot *slot = pool_slot(this);
 
 		*update = this->next;
-		free(this->buf);
 		free(this->space);
 		while (space_list) {
 			void *space = space_list;
 			space_list = *space_list;
 			free(space);
 		}
-		free(this);
+		if (slot) {
+			put_update_slot(slot);
+		} else {
+			free(this->buf);
+			free(this);
+		}
 	}
 }
 
@@ -878,19 +959,23 @@ void manage(struct mdstat_ent *mdstat, struct supertype *container)
 	}
 }
 
-static void handle_message(struct supertype *container, struct metadata_update *msg)
+/* Returns 1 if the slot was queued for the monitor, 0 if the caller
+ * still owns it.
+ */
+static int handle_message(struct supertype *container,
+			  struct update_slot *slot)
 {
 	/* queue this metadata update through to the monitor */
 
-	struct metadata_update *mu;
+	struct metadata_update *mu = &slot->mu;
 
-	if (msg->len <= 0)
+	if (mu->len <= 0)
 		while (update_queue_pending || update_queue) {
 			check_update_queue(container);
 			sleep_for(0, MSEC_TO_NSEC(15), true);
 		}
 
-	if (msg->len == 0) { /* ping_monitor */
+	if (mu->len == 0) { /* ping_monitor */
 		int cnt;
 
 		cnt = monitor_loop_cnt;
@@ -902,31 +987,50 @@ static void handle_message(struct supertype *container, struct metadata_update *
 
 		while (monitor_loop_cnt - cnt < 0)
 			sleep_for(0, MSEC_TO_NSEC(10), true);
-	} else if (msg->len == -1) { /* ping_manager */
+	} else if (mu->len == -1) { /* ping_manager */
 		struct mdstat_ent *mdstat = mdstat_read(1, 0);
 
 		manage(mdstat, container);
 		free_mdstat(mdstat);
 	} else if (!sigterm) {
-		mu = xmalloc(sizeof(*mu));
-		mu->len = msg->len;
-		mu->buf = msg->buf;
-		msg->buf = NULL;
-		mu->space = NULL;
-		mu->space_list = NULL;
-		mu->next = NULL;
 		if (container->ss->prepare_update)
-			if (!container->ss->prepare_update(container, mu))
+			if (!container->ss->prepare_update(container, mu)) {
 				free_updates(&mu);
+				return 1;
+			}
 		queue_metadata_update(mu);
+		return 1;
 	}
+	return 0;
+}
+
+/* Read and queue the @count updates of a batch, then acknowledge them
+ * all at once.
+ */
+static int handle_batch(struct supertype *container, int fd, int count,
+			int tmo)
+{
+	struct update_slot *slot;
+
+	while (count--) {
+		slot = get_update_slot();
+		if (receive_message_buf(fd, &slot->mu, &slot->size,
+					tmo) != 0 || slot->mu.len <= 0) {
+			put_update_slot(slot);
+			return -1;
+		}
+		if (!handle_message(container, slot))
+			put_update_slot(slot);
+	}
+	return ack(fd, tmo);
 }
 
 void read_sock(struct supertype *container)
 {
 	int fd;
-	struct metadata_update msg;
+	struct update_slot *slot = NULL;
 	int terminate = 0;
+	int rv;
 	long fl;
 	int tmo = 3; /* 3 second timeout before hanging up the socket */
 
@@ -946,16 +1050,22 @@ void read_sock(struct supertype *container)
 	}
 
 	do {
-		msg.buf = NULL;
+		if (!slot)
+			slot = get_update_slot();
 
 		/* read and validate the message */
-		if (receive_message(fd, &msg, tmo) == 0) {
-			handle_message(container, &msg);
-			if (msg.len == 0) {
-				/* ping reply with version */
-				msg.buf = Version;
-				msg.len = strlen(Version) + 1;
-				if (send_message(fd, &msg, tmo) < 0)
+		rv = receive_message_buf(fd, &slot->mu, &slot->size, tmo);
+		if (rv == 1) {
+			if (handle_batch(container, fd, slot->mu.len, tmo) < 0)
+				terminate = 1;
+		} else if (rv == 0) {
+			int len = slot->mu.len;
+
+			if (handle_message(container, slot))
+				slot = NULL;
+			if (len == 0) {
+				/* ping reply with version and capabilities */
+				if (send_ping_reply(fd, tmo) < 0)
 					terminate = 1;
 			} else if (ack(fd, tmo) < 0)
 				terminate = 1;
@@ -964,6 +1074,8 @@ void read_sock(struct supertype *container)
 
 	} while (!terminate);
 
+	if (slot)
+		put_update_slot(slot);
 	close(fd);
 }
 
@@ -30,6 +30,7 @@
 #include "xmalloc.h"
 
 #include <ctype.h>
+#include <sys/wait.h>
 
 /**
  * set_bitmap_value() - set bitmap value.
@@ -637,6 +638,17 @@ int main(int argc, char *argv[])
 			s.write_zeroes = 1;
 			continue;
 
+		case O(CREATE, WriteZeroesRate):
+			s.write_zeroes_rate = parse_size(optarg);
+			if (s.write_zeroes_rate == INVALID_SECTORS ||
+			    s.write_zeroes_rate == 0) {
+				pr_err("invalid rate for --write-zeroes-rate: %s\n",
+					optarg);
+				exit(2);
+			}
+			s.write_zeroes_rate = SEC_TO_BYTES(s.write_zeroes_rate);
+			continue;
+
 		case O(GROW,'n'):
 		case O(CREATE,'n'):
 		case O(BUILD,'n'): /* number of raid disks */
@@ -1024,10 +1036,11 @@ int main(int argc, char *argv[])
 				if (strcmp(optarg, "idle") == 0 ||
 				    strcmp(optarg, "frozen") == 0 ||
 				    strcmp(optarg, "check") == 0 ||
+				    strcmp(optarg, "check-dirty") == 0 ||
 				    strcmp(optarg, "repair") == 0)
 					c.action = optarg;
 				else {
-					pr_err("action must be one of idle, frozen, check, repair\n");
+					pr_err("action must be one of idle, frozen, check, check-dirty, repair\n");
 					exit(2);
 				}
 			}
@@ -1254,6 +1267,11 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (s.write_zeroes_rate && !s.write_zeroes) {
+		pr_err("--write-zeroes-rate requires --write-zeroes\n");
+		exit(2);
+	}
+
 	if (s.write_zeroes && !s.assume_clean) {
 		pr_info("Disk zeroing requested, setting --assume-clean to skip resync\n");
 		s.assume_clean = 1;
@@ -1820,11 +1838,38 @@ static int misc_scan(char devmode, struct context *c)
 			else
 				rv |= WaitClean(name, c->verbose);
 			put_md_name(name);
-			map_free(map);
-			map = NULL;
 		}
 	}
+	map_free(map);
 	free_mdstat(ms);
+	if (devmode == 'D')
+		Detail_scan_done();
+	return rv;
+}
+
+/* How many arrays to stop at once */
+#define STOP_MAX_JOBS 32
+
+static int stop_one(struct mdstat_ent *e, int verbose, int last)
+{
+	/* Returns 0 if stopped, 1 on failure and 2 if the array
+	 * could not be opened at all.
+	 */
+	char *name = get_md_name(e->devnm);
+	int mdfd;
+	int rv = 2;
+
+	if (!name) {
+		pr_err("cannot find device file for %s\n",
+			e->devnm);
+		return 2;
+	}
+	mdfd = open_mddev(name, 1);
+	if (mdfd >= 0) {
+		rv = Manage_stop(name, mdfd, verbose, !last) ? 1 : 0;
+		close(mdfd);
+	}
+	put_md_name(name);
 	return rv;
 }
 
@@ -1832,7 +1877,11 @@ static int stop_scan(int verbose)
 {
 	/* apply --stop to all devices in /proc/mdstat */
 	/* Due to possible stacking of devices, repeat until
-	 * nothing more can be stopped
+	 * nothing more can be stopped.
+	 * Stopping an array is mostly waiting for its I/O to drain,
+	 * so the arrays in a pass are stopped concurrently, each in
+	 * its own child.  Containers cannot stop until their members
+	 * have, so they go in a second wave.
 	 */
 	int progress = 1, err;
 	int last = 0;
@@ -1840,28 +1889,51 @@ static int stop_scan(int verbose)
 	do {
 		struct mdstat_ent *ms = mdstat_read(0, 0);
 		struct mdstat_ent *e;
+		int wave;
 
 		if (!progress) last = 1;
 		progress = 0; err = 0;
-		for (e = ms; e; e = e->next) {
-			char *name = get_md_name(e->devnm);
-			int mdfd;
-
-			if (!name) {
-				pr_err("cannot find device file for %s\n",
-					e->devnm);
-				continue;
-			}
-			mdfd = open_mddev(name, 1);
-			if (mdfd >= 0) {
-				if (Manage_stop(name, mdfd, verbose, !last))
-					err = 1;
-				else
-					progress = 1;
-				close(mdfd);
+		fflush(stdout);
+		fflush(stderr);
+		for (wave = 0; wave < 2; wave++) {
+			int running = 0;
+			int status;
+			int res;
+
+			for (e = ms; e; e = e->next) {
+				int container = is_mdstat_ent_external(e) &&
+					!is_mdstat_ent_subarray(e);
+				pid_t pid;
+
+				if (container != wave)
+					continue;
+				if (running == STOP_MAX_JOBS &&
+				    wait(&status) > 0) {
+					res = WIFEXITED(status) ?
+						WEXITSTATUS(status) : 1;
+					err |= res == 1;
+					progress |= res == 0;
+					running--;
+				}
+				pid = fork();
+				if (pid == 0)
+					exit(stop_one(e, verbose, last));
+				if (pid > 0) {
+					running++;
+					continue;
+				}
+				/* Just do it ourselves */
+				res = stop_one(e, verbose, last);
+				err |= res == 1;
+				progress |= res == 0;
+			}
+			while (running && wait(&status) > 0) {
+				res = WIFEXITED(status) ?
+					WEXITSTATUS(status) : 1;
+				err |= res == 1;
+				progress |= res == 0;
+				running--;
 			}
-
-			put_md_name(name);
 		}
 		free_mdstat(ms);
 	} while (!last && err);
@@ -1901,14 +1973,17 @@ static int misc_list(struct mddev_dev *devlist,
 			rv |= Query(dv->devname);
 			continue;
 		case 'X':
-			rv |= ExamineBitmap(dv->devname, c->brief, ss);
+			rv |= ExamineBitmap(dv->devname, c->brief, c->verbose, ss);
 			continue;
 		case ExamineBB:
 			rv |= ExamineBadblocks(dv->devname, c->brief, ss);
 			continue;
 		case 'W':
 		case WaitOpt:
-			rv |= Wait(dv->devname);
+			rv |= Wait(dv);
+			while (dv->next && (dv->next->disposition == 'W' ||
+					    dv->next->disposition == WaitOpt))
+				dv = dv->next;
 			continue;
 		case Waitclean:
 			rv |= WaitClean(dv->devname, c->verbose);
@@ -1926,14 +2001,19 @@ static int misc_list(struct mddev_dev *devlist,
 					      c->update, ident, c->verbose);
 			continue;
 		case Dump:
-			rv |= Dump_metadata(dv->devname, dump_directory, c, ss);
+			rv |= Dump_metadata_list(dv, dump_directory, c, ss);
+			while (dv->next && dv->next->disposition == Dump)
+				dv = dv->next;
 			continue;
 		case Restore:
 			rv |= Restore_metadata(dv->devname, dump_directory, c, ss,
 					       (dv == devlist && dv->next == NULL));
 			continue;
 		case Action:
-			rv |= SetAction(dv->devname, c->action);
+			if (strcmp(c->action, "check-dirty") == 0)
+				rv |= CheckDirtyRegions(dv->devname, c);
+			else
+				rv |= SetAction(dv->devname, c->action);
 			continue;
 		}
 
@@ -1967,6 +2047,7 @@ static int misc_list(struct mddev_dev *devlist,
 		} else
 			rv |= 1;
 	}
+	Detail_scan_done();
 	return rv;
 }
 
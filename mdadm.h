@@ -95,6 +95,18 @@ struct dlm_lksb {
 #define BLKGETSIZE64 _IOR(0x12,114,size_t) /* return device size in bytes (u64 *arg) */
 #endif
 
+#ifndef BLKGETDISKSEQ
+#define BLKGETDISKSEQ _IOR(0x12,128,__u64) /* return disk sequence number (u64 *arg) */
+#endif
+
+#ifndef BLKZEROOUT
+#define BLKZEROOUT _IO(0x12,127) /* zero out a range (u64 range[2]) */
+#endif
+
+#ifndef FALLOC_FL_ZERO_RANGE
+#define FALLOC_FL_ZERO_RANGE 16
+#endif
+
 #define DEFAULT_CHUNK 512
 #define DEFAULT_BITMAP_CHUNK 4096
 #define DEFAULT_BITMAP_DELAY 5
@@ -485,6 +497,7 @@ extern char Version[], Usage[], Help[], OptionHelp[],
 enum special_options {
 	AssumeClean = 300,
 	WriteZeroes,
+	WriteZeroesRate,
 	BitmapChunk,
 	WriteBehind,
 	ReAdd,
@@ -700,6 +713,7 @@ struct shape {
 	enum bitmap_type btype;
 	int	assume_clean;
 	bool	write_zeroes;
+	unsigned long long write_zeroes_rate; /* bytes/sec, 0 for no limit */
 	int	write_behind;
 	unsigned long long size;
 	unsigned long long data_offset;
@@ -745,8 +759,10 @@ struct mdstat_ent {
 
 extern struct mdstat_ent *mdstat_read(int hold, int start);
 extern void mdstat_close(void);
+extern void mdstat_invalidate(void);
 extern void free_mdstat(struct mdstat_ent *ms);
 extern int mdstat_wait(int seconds);
+extern int mdstat_wait_attrs(int *fds, int nfds, int seconds);
 extern void mdstat_wait_fd(int fd, const sigset_t *sigmask);
 extern int mddev_busy(char *devnm);
 extern struct mdstat_ent *mdstat_by_component(char *name);
@@ -823,6 +839,7 @@ typedef enum memb_state {
 } memb_state_t;
 char *map_memb_state(memb_state_t state);
 
+extern unsigned int sysfs_write_generation;
 extern mdadm_status_t sysfs_write_descriptor(const int fd, const char *value,
 					     const ssize_t len, int *errno_p);
 extern mdadm_status_t write_attr(const char *value, const int fd);
@@ -867,6 +884,15 @@ extern int sysfs_unique_holder(char *devnm, long rdev);
 extern int sysfs_freeze_array(struct mdinfo *sra);
 extern int sysfs_wait(int fd, int *msec);
 extern int load_sys(char *path, char *buf, int len);
+/* Ways of zeroing a range, in the order zero_range() tries them */
+enum zero_method {
+	ZERO_FALLOCATE,
+	ZERO_IOCTL,
+	ZERO_WRITE,
+};
+#define ZERO_WRITE_SIZE (1024 * 1024)
+extern int zero_range(int fd, unsigned long long offset, unsigned long long len,
+		      enum zero_method *method);
 extern int zero_disk_range(int fd, unsigned long long sector, size_t count);
 extern int reshape_prepare_fdlist(char *devname,
 				  struct mdinfo *sra,
@@ -1351,7 +1377,7 @@ extern struct superswitch {
 	int (*clear_bad_block)(struct active_array *a, int n,
 					unsigned long long sector, int length);
 
-	/* get list of bad blocks from metadata */
+	/* get list of bad blocks from metadata, sorted by sector */
 	struct md_bb *(*get_bad_blocks)(struct active_array *a, int n);
 
 	int swapuuid; /* true if uuid is bigending rather than hostendian */
@@ -1397,6 +1423,10 @@ struct supertype {
 	int minor_version;
 	int max_devs;
 	char container_devnm[32];    /* devnm of container */
+	char subarray[32];	/* subarray to act on when it can't be
+				 * told from the metadata, e.g. by
+				 * locate_bitmap on a container member
+				 */
 	void *sb;
 	void *info;
 	void *other; /* Hack used to convert v0.90 to v1.0 */
@@ -1434,6 +1464,7 @@ static inline struct supertype *guess_super(int fd) {
 extern struct supertype *dup_super(struct supertype *st);
 extern int get_dev_size(int fd, char *dname, unsigned long long *sizep);
 extern int get_dev_sector_size(int fd, char *dname, unsigned int *sectsizep);
+extern int get_disk_identity(int fd, dev_t *devidp, unsigned long long *seqp);
 extern int must_be_container(int fd);
 void wait_for(char *dev, int fd);
 
@@ -1462,6 +1493,8 @@ struct pol_rule {
 		char *name;
 		char *value;
 		char *dups; /* duplicates of 'value' with a partNN appended */
+		int prefix_len; /* length of 'value' before any glob character */
+		int literal; /* 'value' contains no glob characters */
 	} *rule;
 };
 
@@ -1472,6 +1505,7 @@ extern char type_part[], type_disk[];
 extern void policyline(char *line, char *type);
 extern void policy_add(char *type, ...);
 extern void policy_free(void);
+extern void policy_cache_flush(void);
 
 extern struct dev_policy *path_policy(char **paths, char *type);
 extern struct dev_policy *disk_policy(struct mdinfo *disk);
@@ -1607,6 +1641,7 @@ extern int Create(struct supertype *st, struct mddev_ident *ident, int subdevs,
 		  struct mddev_dev *devlist, struct shape *s, struct context *c);
 
 extern int Detail(char *dev, struct context *c);
+extern void Detail_scan_done(void);
 extern int Detail_Platform(struct superswitch *ss, int scan, int verbose, int export, char *controller_path);
 extern int Query(char *dev);
 extern int ExamineBadblocks(char *devname, int brief, struct supertype *forcest);
@@ -1622,7 +1657,7 @@ extern int Monitor(struct mddev_dev *devlist,
 extern int Kill(char *dev, struct supertype *st, int force, int verbose, int noexcl);
 extern int Kill_subarray(char *dev, char *subarray, int verbose);
 extern int Update_subarray(char *dev, char *subarray, enum update_opt update, struct mddev_ident *ident, int quiet);
-extern int Wait(char *dev);
+extern int Wait(struct mddev_dev *devlist);
 extern int WaitClean(char *dev, int verbose);
 extern int SetAction(char *dev, char *action);
 
@@ -1636,8 +1671,9 @@ extern int CreateBitmap(char *filename, int force, char uuid[16],
 			unsigned long write_behind,
 			unsigned long long array_size,
 			int major);
-extern int ExamineBitmap(char *filename, int brief, struct supertype *st);
+extern int ExamineBitmap(char *filename, int brief, int verbose, struct supertype *st);
 extern int IsBitmapDirty(char *filename);
+extern int CheckDirtyRegions(char *dev, struct context *c);
 extern int Write_rules(char *rule_name);
 extern int bitmap_update_uuid(int fd, int *uuid, int swap);
 
@@ -1650,6 +1686,8 @@ bitmap_bits(unsigned long long array_size, unsigned long chunksize)
 
 extern int Dump_metadata(char *dev, char *dir, struct context *c,
 			 struct supertype *st);
+extern int Dump_metadata_list(struct mddev_dev *devlist, char *dir,
+			      struct context *c, struct supertype *st);
 extern int Restore_metadata(char *dev, char *dir, struct context *c,
 			    struct supertype *st, int only);
 
@@ -1721,6 +1759,7 @@ extern int use_udev(void);
 extern void print_escape(char *str);
 extern unsigned long GCD(unsigned long a, unsigned long b);
 extern int conf_name_is_free(char *name);
+extern void conf_used_minors(unsigned long long *map, int bits);
 extern bool is_devname_ignore(const char *devname);
 extern bool is_devname_md_numbered(const char *devname);
 extern bool is_devname_md_d_numbered(const char *devname);
@@ -1874,6 +1913,7 @@ extern void set_dlm_hooks(void);
 #define MSEC_TO_NSEC(msec) ((msec) * 1000000)
 #define USEC_TO_NSEC(usec) ((usec) * 1000)
 extern void sleep_for(unsigned int sec, long nsec, bool wake_after_interrupt);
+extern bool retry_wait(int fd, int *waited, int budget);
 extern bool is_directory(const char *path);
 extern bool is_file(const char *path);
 extern int s_gethostname(char *buf, int buf_len);
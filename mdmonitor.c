@@ -1135,6 +1135,8 @@ static void try_spare_migration(struct state *statelist)
 	struct state *from;
 	struct state *st;
 
+	/* Devices may have come and gone since we last looked */
+	policy_cache_flush();
 	link_containers_with_subarrays(statelist);
 	for (st = statelist; st; st = st->next)
 		if (st->active < st->raid && st->spare == 0 && !st->err) {
@@ -1246,69 +1248,158 @@ static void free_statelist(struct state *statelist)
 }
 
 /* Not really Monitor but ... */
-int Wait(char *dev)
-{
+struct wait_ent {
 	char devnm[32];
-	dev_t rdev;
-	char *tmp;
-	int rv = 1;
-	int frozen_remaining = 3;
+	int fd;			/* sync_action, or -1 */
+	int frozen_remaining;
+	int rv;
+	int done;
+};
 
-	if (!stat_is_blkdev(dev, &rdev))
-		return 2;
+/* Read the held sync_action attribute.  This also re-arms it for
+ * poll(), which otherwise keeps reporting POLLPRI, so it has to be
+ * done on every pass.
+ */
+static int wait_read_action(struct wait_ent *w, char *buf, int len)
+{
+	int n = -1;
 
-	tmp = devid2devnm(rdev);
-	if (!tmp) {
-		pr_err("Cannot get md device name.\n");
-		return 2;
+	if (w->fd >= 0 && lseek(w->fd, 0, SEEK_SET) == 0) {
+		n = read(w->fd, buf, len - 1);
+		if (n >= 0)
+			buf[n] = '\0';
 	}
+	return n;
+}
 
-	snprintf(devnm, sizeof(devnm), "%s", tmp);
+/* Returns 1 once nothing is running on the array, and pings its
+ * metadata manager so that the metadata is up to date.
+ */
+static int wait_check(struct wait_ent *w, struct mdstat_ent *ms, int tick)
+{
+	char buf[SYSFS_MAX_BUF_SIZE];
+	struct mdstat_ent *e;
+	int n;
 
-	while(1) {
-		struct mdstat_ent *ms = mdstat_read(1, 0);
-		struct mdstat_ent *e;
+	n = wait_read_action(w, buf, sizeof(buf));
 
-		for (e = ms; e; e = e->next)
-			if (strcmp(e->devnm, devnm) == 0)
-				break;
+	for (e = ms; e; e = e->next)
+		if (strcmp(e->devnm, w->devnm) == 0)
+			break;
 
-		if (e && e->percent == RESYNC_NONE) {
-			/* We could be in the brief pause before something
-			 * starts. /proc/mdstat doesn't show that, but
-			 * sync_action does.
-			 */
+	if (e && e->percent == RESYNC_NONE) {
+		/* We could be in the brief pause before something
+		 * starts. /proc/mdstat doesn't show that, but
+		 * sync_action does.
+		 */
+		if (n < 0) {
 			struct mdinfo mdi;
-			char buf[SYSFS_MAX_BUF_SIZE];
 
-			if (sysfs_init(&mdi, -1, devnm))
-				return 2;
-			if (sysfs_get_str(&mdi, NULL, "sync_action",
-					  buf, sizeof(buf)) > 0 &&
-			    strcmp(buf,"idle\n") != 0) {
-				e->percent = RESYNC_UNKNOWN;
-				if (strcmp(buf, "frozen\n") == 0) {
-					if (frozen_remaining == 0)
-						e->percent = RESYNC_NONE;
-					else
-						frozen_remaining -= 1;
-				}
+			if (sysfs_init(&mdi, -1, w->devnm)) {
+				w->rv = 2;
+				return 1;
 			}
+			n = sysfs_get_str(&mdi, NULL, "sync_action",
+					  buf, sizeof(buf));
 		}
-		if (!e || e->percent == RESYNC_NONE) {
-			if (e && is_mdstat_ent_external(e)) {
-				if (is_subarray(&e->metadata_version[9]))
-					ping_monitor(&e->metadata_version[9]);
-				else
-					ping_monitor(devnm);
+		if (n > 0 && strcmp(buf, "idle\n") != 0) {
+			e->percent = RESYNC_UNKNOWN;
+			if (strcmp(buf, "frozen\n") == 0) {
+				if (w->frozen_remaining == 0)
+					e->percent = RESYNC_NONE;
+				else if (tick)
+					w->frozen_remaining -= 1;
 			}
-			free_mdstat(ms);
-			return rv;
+		}
+	}
+	if (!e || e->percent == RESYNC_NONE) {
+		if (e && is_mdstat_ent_external(e)) {
+			if (is_subarray(&e->metadata_version[9]))
+				ping_monitor(&e->metadata_version[9]);
+			else
+				ping_monitor(w->devnm);
+		}
+		return 1;
+	}
+	w->rv = 0;
+	return 0;
+}
+
+/* Wait for resync/recovery/reshape to finish on each device in
+ * 'devlist', up to the first that isn't marked for --wait.  All of them
+ * are watched together: /proc/mdstat and every array's sync_action are
+ * polled, so an array is finished with as soon as the kernel reports it
+ * idle.  The 5 second timeout only bounds how long a frozen array is
+ * waited for.
+ */
+int Wait(struct mddev_dev *devlist)
+{
+	struct mddev_dev *dv;
+	struct wait_ent *w;
+	int *fds;
+	int n = 0, pending = 0;
+	int tick = 1;
+	int rv = 0;
+	int i;
+
+	for (dv = devlist; dv && (dv->disposition == 'W' ||
+				  dv->disposition == WaitOpt); dv = dv->next)
+		n++;
+	w = xcalloc(n, sizeof(*w));
+	fds = xcalloc(n, sizeof(*fds));
+
+	for (i = 0, dv = devlist; i < n; i++, dv = dv->next) {
+		dev_t rdev;
+		char *tmp;
+
+		w[i].fd = fds[i] = -1;
+		w[i].rv = 1;
+		w[i].frozen_remaining = 3;
+		w[i].done = 1;
+		if (!stat_is_blkdev(dv->devname, &rdev)) {
+			w[i].rv = 2;
+			continue;
+		}
+		tmp = devid2devnm(rdev);
+		if (!tmp) {
+			pr_err("Cannot get md device name.\n");
+			w[i].rv = 2;
+			continue;
+		}
+		snprintf(w[i].devnm, sizeof(w[i].devnm), "%s", tmp);
+		w[i].fd = fds[i] = sysfs_open(w[i].devnm, NULL, "sync_action");
+		if (w[i].fd >= 0) {
+			char buf[SYSFS_MAX_BUF_SIZE];
+
+			/* an attribute never read polls as changed */
+			wait_read_action(&w[i], buf, sizeof(buf));
+		}
+		w[i].done = 0;
+		pending++;
+	}
+
+	while (pending) {
+		struct mdstat_ent *ms = mdstat_read(1, 0);
+
+		for (i = 0; i < n; i++) {
+			if (w[i].done || !wait_check(&w[i], ms, tick))
+				continue;
+			w[i].done = 1;
+			pending--;
+			if (w[i].fd >= 0)
+				close(w[i].fd);
+			w[i].fd = fds[i] = -1;
 		}
 		free_mdstat(ms);
-		rv = 0;
-		mdstat_wait(5);
+		if (pending)
+			tick = mdstat_wait_attrs(fds, n, 5) == 0;
 	}
+
+	for (i = 0; i < n; i++)
+		rv |= w[i].rv;
+	free(fds);
+	free(w);
+	return rv;
 }
 
 /* The state "broken" is used only for RAID0/LINEAR - it's the same as
@@ -73,33 +73,74 @@ int create_named_array(char *devnm)
 	return 1;
 }
 
+#define MD_SCAN_MINORS	512
+#define MD_SCAN_WORDS	(MD_SCAN_MINORS / 64)
+
+/* Highest clear bit in [lo, hi] of @map, or -1 */
+static int highest_free_minor(unsigned long long *map, int lo, int hi)
+{
+	int n = hi;
+
+	while (n >= lo) {
+		unsigned long long avail = ~map[n / 64];
+		int bit = n % 64;
+
+		if (bit < 63)
+			avail &= (2ULL << bit) - 1;
+		if (avail) {
+			n = (n / 64) * 64 + 63 - __builtin_clzll(avail);
+			return n >= lo ? n : -1;
+		}
+		n = (n / 64) * 64 - 1;
+	}
+	return -1;
+}
+
 char *find_free_devnm(void)
 {
 	static char devnm[MD_NAME_MAX];
+	unsigned long long used[MD_SCAN_WORDS] = { 0 };
+	struct mdstat_ent *mdstat, *me;
 	int devnum;
 
-	for (devnum = 127; devnum != 128; devnum = devnum ? devnum - 1 : 511) {
-		sprintf(devnm, "md%d", devnum);
+	/* Collect the minors taken by running arrays and by mdadm.conf once,
+	 * then hand out the first free one in the order 127..0, 511..129.
+	 */
+	mdstat = mdstat_read(0, 0);
+	for (me = mdstat; me; me = me->next) {
+		char *end;
+		long n;
 
-		if (mddev_busy(devnm))
+		if (strncmp(me->devnm, "md", 2) != 0 || !isdigit(me->devnm[2]))
 			continue;
+		n = strtol(me->devnm + 2, &end, 10);
+		if (*end == 0 && n < MD_SCAN_MINORS)
+			used[n / 64] |= 1ULL << (n % 64);
+	}
+	free_mdstat(mdstat);
 
-		if (!conf_name_is_free(devnm))
-			continue;
+	conf_used_minors(used, MD_SCAN_MINORS);
+	used[128 / 64] |= 1ULL << (128 % 64);
+
+	while (1) {
+		devnum = highest_free_minor(used, 0, 127);
+		if (devnum < 0)
+			devnum = highest_free_minor(used, 129, MD_SCAN_MINORS - 1);
+		if (devnum < 0)
+			return NULL;
+		sprintf(devnm, "md%d", devnum);
 
 		if (!udev_is_available()) {
 			/* make sure it is new to /dev too*/
 			dev_t devid = devnm2devid(devnm);
 
-			if (devid && map_dev(major(devid), minor(devid), 0))
+			if (devid && map_dev(major(devid), minor(devid), 0)) {
+				used[devnum / 64] |= 1ULL << (devnum % 64);
 				continue;
+			}
 		}
-
-		break;
+		return devnm;
 	}
-	if (devnum == 128)
-		return NULL;
-	return devnm;
 }
 
 /*
@@ -83,7 +83,9 @@
 #include	"xmalloc.h"
 
 #include	<sys/select.h>
+#include	<poll.h>
 #include	<ctype.h>
+#include	<time.h>
 
 static void free_member_devnames(struct dev_member *m)
 {
@@ -176,6 +178,98 @@ bool is_container_member(struct mdstat_ent *mdstat, char *container)
 	return false;
 }
 
+/*
+ * A single command may look at mdstat many times (mddev_busy(),
+ * mdstat_by_component(), Detail(), map rebuilding...), so the last parse
+ * is kept and copied out again while it is known to be current.  It is
+ * dropped when:
+ *  - the kernel reports an md event on /proc/mdstat, which it does for
+ *    arrays starting, stopping, and devices being added, removed or
+ *    failing, whoever made the change,
+ *  - this process writes to sysfs (sysfs_write_generation) or calls an
+ *    md ioctl that changes an array (mdstat_invalidate()),
+ *  - mdstat_wait() and friends return,
+ *  - it is older than MDSTAT_SNAPSHOT_MSEC, as resync progress is not
+ *    an md event,
+ *  - the process forked.  A child shares the open file description, and
+ *    with it the pending md event, so it gets its own descriptor rather
+ *    than consuming events the parent relies on.
+ * Reads with 'hold' always go to the kernel.
+ */
+#define MDSTAT_SNAPSHOT_MSEC 1000
+
+static struct mdstat_ent *mdstat_snapshot;
+static int mdstat_snapshot_fd = -1;
+static unsigned int mdstat_snapshot_gen;
+static struct timespec mdstat_snapshot_time;
+static pid_t mdstat_snapshot_pid;
+
+void mdstat_invalidate(void)
+{
+	free_mdstat(mdstat_snapshot);
+	mdstat_snapshot = NULL;
+}
+
+/* Drop a snapshot and descriptor inherited from the parent process */
+static void mdstat_snapshot_check_pid(void)
+{
+	if (mdstat_snapshot_fd == -1 || mdstat_snapshot_pid == getpid())
+		return;
+
+	mdstat_invalidate();
+	close(mdstat_snapshot_fd);
+	mdstat_snapshot_fd = -1;
+}
+
+static struct mdstat_ent *mdstat_copy(struct mdstat_ent *ms, int reverse)
+{
+	struct mdstat_ent *rv = NULL, **end = &rv;
+
+	for (; ms; ms = ms->next) {
+		struct mdstat_ent *e = xmalloc(sizeof(*e));
+		struct dev_member *m, **mend = &e->members;
+
+		*e = *ms;
+		e->level = ms->level ? xstrdup(ms->level) : NULL;
+		e->pattern = ms->pattern ? xstrdup(ms->pattern) : NULL;
+		e->metadata_version = ms->metadata_version ?
+			xstrdup(ms->metadata_version) : NULL;
+		for (m = ms->members; m; m = m->next) {
+			*mend = xmalloc(sizeof(**mend));
+			(*mend)->name = xstrdup(m->name);
+			mend = &(*mend)->next;
+		}
+		*mend = NULL;
+		if (reverse) {
+			e->next = rv;
+			rv = e;
+		} else {
+			e->next = NULL;
+			*end = e;
+			end = &e->next;
+		}
+	}
+	return rv;
+}
+
+static bool mdstat_snapshot_current(void)
+{
+	struct pollfd pfd = { .fd = mdstat_snapshot_fd, .events = POLLPRI };
+	struct timespec now;
+
+	if (!mdstat_snapshot)
+		return false;
+	if (mdstat_snapshot_gen != sysfs_write_generation)
+		return false;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if ((now.tv_sec - mdstat_snapshot_time.tv_sec) * 1000 +
+	    (now.tv_nsec - mdstat_snapshot_time.tv_nsec) / 1000000 >=
+	    MDSTAT_SNAPSHOT_MSEC)
+		return false;
+	/* POLLPRI once an md event has happened since the last read */
+	return poll(&pfd, 1, 0) == 0;
+}
+
 static int mdstat_fd = -1;
 struct mdstat_ent *mdstat_read(int hold, int start)
 {
@@ -184,12 +278,20 @@ struct mdstat_ent *mdstat_read(int hold, int start)
 	char *line;
 	int fd;
 
-	if (hold && mdstat_fd != -1) {
-		off_t offset = lseek(mdstat_fd, 0L, 0);
+	if (!hold) {
+		mdstat_snapshot_check_pid();
+		if (mdstat_snapshot_current())
+			return mdstat_copy(mdstat_snapshot, start);
+	}
+
+	if ((hold && mdstat_fd != -1) ||
+	    (!hold && mdstat_snapshot_fd != -1)) {
+		off_t offset = lseek(hold ? mdstat_fd : mdstat_snapshot_fd,
+				     0L, 0);
 		if (offset == (off_t)-1) {
 			return NULL;
 		}
-		fd = dup(mdstat_fd);
+		fd = dup(hold ? mdstat_fd : mdstat_snapshot_fd);
 		if (fd >= 0)
 			f = fdopen(fd, "r");
 		else
@@ -341,6 +443,19 @@ struct mdstat_ent *mdstat_read(int hold, int start)
 			return NULL;
 		}
 	}
+	if (!hold) {
+		if (mdstat_snapshot_fd == -1) {
+			mdstat_snapshot_fd = fcntl(fileno(f), F_DUPFD_CLOEXEC, 0);
+			mdstat_snapshot_pid = getpid();
+		}
+		mdstat_invalidate();
+		if (mdstat_snapshot_fd >= 0) {
+			mdstat_snapshot = mdstat_copy(all, 0);
+			mdstat_snapshot_gen = sysfs_write_generation;
+			clock_gettime(CLOCK_MONOTONIC,
+				      &mdstat_snapshot_time);
+		}
+	}
 	fclose(f);
 
 	/* If we might want to start array,
@@ -381,6 +496,7 @@ int mdstat_wait(int seconds)
 	fd_set fds;
 	struct timeval tm;
 	int maxfd = 0;
+	int rv;
 	FD_ZERO(&fds);
 	if (mdstat_fd >= 0) {
 		FD_SET(mdstat_fd, &fds);
@@ -391,7 +507,34 @@ int mdstat_wait(int seconds)
 	tm.tv_sec = seconds;
 	tm.tv_usec = 0;
 
-	return select(maxfd + 1, NULL, NULL, &fds, &tm);
+	rv = select(maxfd + 1, NULL, NULL, &fds, &tm);
+	mdstat_invalidate();
+	return rv;
+}
+
+/* Like mdstat_wait(), but also return as soon as any of the @nfds sysfs
+ * attributes in @fds is notified.  Negative entries in @fds are ignored.
+ */
+int mdstat_wait_attrs(int *fds, int nfds, int seconds)
+{
+	struct pollfd *pfd = xcalloc(nfds + 1, sizeof(*pfd));
+	int n = 0;
+	int i, rv;
+
+	if (mdstat_fd >= 0) {
+		pfd[n].fd = mdstat_fd;
+		pfd[n++].events = POLLPRI;
+	}
+	for (i = 0; i < nfds; i++)
+		if (fds[i] >= 0) {
+			pfd[n].fd = fds[i];
+			pfd[n++].events = POLLPRI;
+		}
+
+	rv = poll(pfd, n, seconds * 1000);
+	free(pfd);
+	mdstat_invalidate();
+	return rv;
 }
 
 void mdstat_wait_fd(int fd, const sigset_t *sigmask)
@@ -426,6 +569,7 @@ void mdstat_wait_fd(int fd, const sigset_t *sigmask)
 
 	pselect(maxfd + 1, &rfds, NULL, &fds,
 		NULL, sigmask);
+	mdstat_invalidate();
 }
 
 int mddev_busy(char *devnm)
@@ -22,6 +22,7 @@
 #include "mdmon.h"
 #include <sys/syscall.h>
 #include <sys/select.h>
+#include <limits.h>
 
 static char *array_states[] = {
 	"clear", "inactive", "suspended", "readonly", "read-auto",
@@ -159,20 +160,71 @@ int read_dev_state(int fd)
 	return rv;
 }
 
-int process_ubb(struct active_array *a, struct mdinfo *mdi, const unsigned long
-		long sector, const int length, const char *buf,
+/* sysfs attributes are at most a page, this covers the largest page size */
+#define BB_FILE_BUF_SIZE (64 * 1024)
+
+/*
+ * parse one "sector length\n" entry of a kernel bad_blocks file, return
+ * pointer past it or NULL if malformed
+ */
+static char *parse_bb_entry(char *p, unsigned long long *sector, int *length)
+{
+	unsigned long long s = 0;
+	unsigned long long l = 0;
+	char *q;
+
+	for (q = p; *q >= '0' && *q <= '9'; q++)
+		s = s * 10 + (*q - '0');
+	if (q == p || *q++ != ' ')
+		return NULL;
+	for (p = q; *q >= '0' && *q <= '9'; q++)
+		l = l * 10 + (*q - '0');
+	if (q == p || *q++ != '\n' || l == 0 || l > INT_MAX)
+		return NULL;
+
+	*sector = s;
+	*length = l;
+	return q;
+}
+
+int process_ubb(struct active_array *a, struct mdinfo *mdi, char *buf,
 		const int buf_len)
 {
 	struct superswitch *ss = a->container->ss;
+	char *end = buf + buf_len;
+	char *p, *next;
+	int count = 0;
 
 	/*
-	 * record bad block in metadata first, then acknowledge it to the driver
-	 * via sysfs file
+	 * record all bad blocks in metadata first, then acknowledge them to
+	 * the driver via sysfs file. The driver takes one entry per write.
 	 */
-	if ((ss->record_bad_block(a, mdi->disk.raid_disk, sector, length)) &&
-	    (sysfs_write_descriptor(mdi->bb_fd, buf, buf_len, NULL) == MDADM_STATUS_SUCCESS))
-		return 1;
+	for (p = buf; p < end; p = next) {
+		unsigned long long sector;
+		int length;
+
+		next = parse_bb_entry(p, &sector, &length);
+		if (!next)
+			return -1;
+		if (!ss->record_bad_block(a, mdi->disk.raid_disk, sector,
+					  length))
+			goto fail;
+		count++;
+	}
+
+	for (p = buf; p < end; p = next) {
+		unsigned long long sector;
+		int length;
 
+		next = parse_bb_entry(p, &sector, &length);
+		if (sysfs_write_descriptor(mdi->bb_fd, p, next - p, NULL) !=
+		    MDADM_STATUS_SUCCESS)
+			goto fail;
+	}
+
+	return count;
+
+fail:
 	/*
 	 * failed to store or acknowledge bad block, switch of bad block support
 	 * to get it out of blocked state
@@ -187,30 +239,47 @@ int compare_bb(struct active_array *a, struct mdinfo *mdi, const unsigned long
 	struct superswitch *ss = a->container->ss;
 	struct md_bb *bb = (struct md_bb *) arg;
 	int record = 1;
+	int lo = 0, hi = bb->count;
 	int i;
 
-	for (i = 0; i < bb->count; i++) {
-		unsigned long long start = bb->entries[i].sector;
-		unsigned long long len = bb->entries[i].length;
+	/*
+	 * metadata list is sorted by sector, find the entries starting at
+	 * or before this bad block. Entries already matched are left in
+	 * place with zero length so that the list stays sorted.
+	 */
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
 
-		/*
-		 * bad block in metadata exactly matches bad block in kernel
-		 * list, just remove it from a list
-		 */
-		if ((start == sector) && (len == length)) {
-			if (i < bb->count - 1)
-				bb->entries[i] = bb->entries[bb->count - 1];
-			bb->count -= 1;
+		if (bb->entries[mid].sector <= sector)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/*
+	 * bad block in metadata exactly matches bad block in kernel
+	 * list, just remove it from a list
+	 */
+	for (i = lo - 1; i >= 0 && bb->entries[i].sector == sector; i--) {
+		if (bb->entries[i].length == (int)length) {
+			bb->entries[i].length = 0;
 			record = 0;
 			break;
 		}
-		/*
-		 * bad block in metadata spans bad block in kernel list,
-		 * clear it and record new bad block
-		 */
-		if ((sector >= start) && (sector + length <= start + len)) {
-			ss->clear_bad_block(a, mdi->disk.raid_disk, start, len);
-			break;
+	}
+
+	/*
+	 * bad block in metadata spans bad block in kernel list,
+	 * clear it and record new bad block
+	 */
+	if (record && lo > 0) {
+		struct md_bb_entry *e = &bb->entries[lo - 1];
+
+		if (e->length &&
+		    sector + length <= e->sector + e->length) {
+			ss->clear_bad_block(a, mdi->disk.raid_disk, e->sector,
+					    e->length);
+			e->length = 0;
 		}
 	}
 
@@ -227,72 +296,47 @@ int compare_bb(struct active_array *a, struct mdinfo *mdi, const unsigned long
 static int read_bb_file(int fd, struct active_array *a, struct mdinfo *mdi,
 			enum bb_action action, void *arg)
 {
-	char buf[30];
-	int n = 0;
+	static char buf[BB_FILE_BUF_SIZE];
+	char *p, *next;
 	int ret = 0;
-	int read_again = 0;
-	int off = 0;
-	int pos = 0;
-	int preserve_pos = (action == RECORD_BB ? 0 : 1);
+	int n = 0;
+	int rv;
 
 	if (lseek(fd, 0, SEEK_SET) == (off_t) -1)
 		return -1;
 
 	do {
-		read_again = 0;
-		n = read(fd, buf + pos, sizeof(buf) - 1 - pos);
-		if (n < 0)
+		rv = read(fd, buf + n, sizeof(buf) - 1 - n);
+		if (rv < 0)
 			return -1;
-		n += pos;
-
-		buf[n] = '\0';
-		off = 0;
-
-		while (off < n) {
-			unsigned long long sector;
-			int length;
-			char newline;
-			int consumed;
-			int matched;
-			int rc;
-
-			/* kernel sysfs file format: "sector length\n" */
-			matched = sscanf(buf + off, "%llu %d%c%n", &sector,
-					 &length, &newline, &consumed);
-			if ((matched != 3) && (off > 0)) {
-				/* truncated entry, read again */
-				if (preserve_pos) {
-					pos = sizeof(buf) - off - 1;
-					memmove(buf, buf + off, pos);
-				} else {
-					if (lseek(fd, 0, SEEK_SET) ==
-					    (off_t) -1)
-						return -1;
-				}
-				read_again = 1;
-				break;
-			}
-			if (matched != 3)
-				return -1;
-			if (newline != '\n')
-				return -1;
-			if (length <= 0)
-				return -1;
-
-			if (action == RECORD_BB)
-				rc = process_ubb(a, mdi, sector, length,
-						  buf + off, consumed);
-			else if (action == COMPARE_BB)
-				rc = compare_bb(a, mdi, sector, length, arg);
-			else
-				rc = -1;
+		n += rv;
+	} while (rv > 0 && n < (int)sizeof(buf) - 1);
 
-			if (rc < 0)
-				return rc;
-			ret += rc;
-			off += consumed;
-		}
-	} while (read_again);
+	/* drop a truncated last entry, it is seen again on the next pass */
+	while (n > 0 && buf[n - 1] != '\n')
+		n--;
+	buf[n] = '\0';
+
+	if (action == RECORD_BB)
+		return process_ubb(a, mdi, buf, n);
+	if (action != COMPARE_BB)
+		return -1;
+
+	/* kernel sysfs file format: "sector length\n" */
+	for (p = buf; p < buf + n; p = next) {
+		unsigned long long sector;
+		int length;
+		int rc;
+
+		next = parse_bb_entry(p, &sector, &length);
+		if (!next)
+			return -1;
+
+		rc = compare_bb(a, mdi, sector, length, arg);
+		if (rc < 0)
+			return rc;
+		ret += rc;
+	}
 
 	return ret;
 }
@@ -324,7 +368,9 @@ static int check_for_cleared_bb(struct active_array *a, struct mdinfo *mdi)
 		unsigned long long sector = bb->entries[i].sector;
 		int length = bb->entries[i].length;
 
-		ss->clear_bad_block(a, mdi->disk.raid_disk, sector, length);
+		if (length)
+			ss->clear_bad_block(a, mdi->disk.raid_disk, sector,
+					    length);
 	}
 
 	return 0;
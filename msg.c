@@ -27,6 +27,7 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include "mdadm.h"
 #include "mdmon.h"
@@ -34,6 +35,18 @@
 
 static const __u32 start_magic = 0x5a5aa5a5;
 static const __u32 end_magic = 0xa5a55a5a;
+static const __u32 batch_magic = 0x5a5aa5a6;
+
+/* Capabilities mdmon lists after the NUL that ends the version string in
+ * its ping reply.  Older mdadm only parses the version string, older mdmon
+ * sends nothing after it.
+ */
+#define MDMON_CAPS "batch"
+
+static struct {
+	char devnm[32];
+	int caps;
+} mdmon_caps_cache = { .caps = -1 };
 
 static int send_buf(int fd, const void* buf, int len, int tmo)
 {
@@ -79,6 +92,38 @@ static int recv_buf(int fd, void* buf, int len, int tmo)
 	return 0;
 }
 
+static int send_iov(int fd, struct iovec *iov, int cnt, int tmo)
+{
+	fd_set set;
+	int rv;
+	struct timeval timeout = {tmo, 0};
+	struct timeval *ptmo = tmo ? &timeout : NULL;
+	struct msghdr mh = { 0 };
+
+	while (cnt) {
+		FD_ZERO(&set);
+		FD_SET(fd, &set);
+		rv = select(fd+1, NULL, &set, NULL, ptmo);
+		if (rv <= 0)
+			return -1;
+		mh.msg_iov = iov;
+		mh.msg_iovlen = cnt;
+		rv = sendmsg(fd, &mh, 0);
+		if (rv <= 0)
+			return -1;
+		while (cnt && (size_t)rv >= iov->iov_len) {
+			rv -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt) {
+			iov->iov_base += rv;
+			iov->iov_len -= rv;
+		}
+	}
+	return 0;
+}
+
 int send_message(int fd, struct metadata_update *msg, int tmo)
 {
 	__s32 len = msg->len;
@@ -93,33 +138,110 @@ int send_message(int fd, struct metadata_update *msg, int tmo)
 	return rv;
 }
 
-int receive_message(int fd, struct metadata_update *msg, int tmo)
+/* Send the first @count updates of the list at @mu as one batch: a
+ * batch header followed by each update framed as by send_message().
+ * The payloads are passed to sendmsg() in place rather than copied.
+ * Only for use once mdmon_capabilities() has reported MDMON_CAP_BATCH.
+ */
+int send_message_batch(int fd, struct metadata_update *mu, int count,
+		       int tmo)
+{
+	struct iovec iov[2 + 4 * MSG_BATCH_MAX];
+	__s32 lens[MSG_BATCH_MAX];
+	__s32 cnt = count;
+	int n = 0;
+	int i;
+
+	if (count <= 0 || count > MSG_BATCH_MAX)
+		return -1;
+
+	iov[n].iov_base = (void *)&batch_magic;
+	iov[n++].iov_len = 4;
+	iov[n].iov_base = &cnt;
+	iov[n++].iov_len = 4;
+	for (i = 0; i < count; i++, mu = mu->next) {
+		if (!mu || mu->len <= 0)
+			return -1;
+		lens[i] = mu->len;
+		iov[n].iov_base = (void *)&start_magic;
+		iov[n++].iov_len = 4;
+		iov[n].iov_base = &lens[i];
+		iov[n++].iov_len = 4;
+		iov[n].iov_base = mu->buf;
+		iov[n++].iov_len = mu->len;
+		iov[n].iov_base = (void *)&end_magic;
+		iov[n++].iov_len = 4;
+	}
+	return send_iov(fd, iov, n, tmo);
+}
+
+int send_ping_reply(int fd, int tmo)
+{
+	struct metadata_update msg;
+	int len = strlen(Version) + 1;
+	int rv;
+
+	msg.len = len + sizeof(MDMON_CAPS);
+	msg.buf = xmalloc(msg.len);
+	memcpy(msg.buf, Version, len);
+	memcpy(msg.buf + len, MDMON_CAPS, sizeof(MDMON_CAPS));
+	rv = send_message(fd, &msg, tmo);
+	free(msg.buf);
+	return rv;
+}
+
+/* Like receive_message(), but the payload goes into msg->buf, which holds
+ * *size bytes and is grown as needed.  The buffer stays with the caller
+ * whether or not the receive succeeds.
+ * Returns 1, with msg->len set to the number of updates that follow, if
+ * a batch header was received; each update is then read with a further
+ * call.
+ */
+int receive_message_buf(int fd, struct metadata_update *msg, int *size,
+			int tmo)
 {
 	__u32 magic;
 	__s32 len;
 	int rv;
 
 	rv = recv_buf(fd, &magic, 4, tmo);
-	if (rv < 0 || magic != start_magic)
+	if (rv < 0 || (magic != start_magic && magic != batch_magic))
 		return -1;
 	rv = recv_buf(fd, &len, 4, tmo);
 	if (rv < 0 || len > MSG_MAX_LEN)
 		return -1;
+	if (magic == batch_magic) {
+		if (len <= 0 || len > MSG_BATCH_MAX)
+			return -1;
+		msg->len = len;
+		return 1;
+	}
 	if (len > 0) {
-		msg->buf = xmalloc(len);
-		rv = recv_buf(fd, msg->buf, len, tmo);
-		if (rv < 0) {
+		if (len > *size) {
 			free(msg->buf);
-			return -1;
+			msg->buf = xmalloc(len);
+			*size = len;
 		}
-	} else
-		msg->buf = NULL;
+		rv = recv_buf(fd, msg->buf, len, tmo);
+		if (rv < 0)
+			return -1;
+	}
 	rv = recv_buf(fd, &magic, 4, tmo);
-	if (rv < 0 || magic != end_magic) {
+	if (rv < 0 || magic != end_magic)
+		return -1;
+	msg->len = len;
+	return 0;
+}
+
+int receive_message(int fd, struct metadata_update *msg, int tmo)
+{
+	int size = 0;
+
+	msg->buf = NULL;
+	if (receive_message_buf(fd, msg, &size, tmo) != 0) {
 		free(msg->buf);
 		return -1;
 	}
-	msg->len = len;
 	return 0;
 }
 
@@ -223,6 +345,61 @@ int ping_monitor(char *devname)
 	return err;
 }
 
+static int parse_mdmon_caps(struct metadata_update *msg)
+{
+	char *end = msg->buf + msg->len;
+	char *cp;
+	int caps = 0;
+
+	cp = memchr(msg->buf, 0, msg->len);
+	if (!cp || end[-1] != 0)
+		return 0;
+	for (cp++; cp < end && *cp; ) {
+		int n = strcspn(cp, " ");
+
+		if (n == 5 && strncmp(cp, "batch", 5) == 0)
+			caps |= MDMON_CAP_BATCH;
+		cp += n;
+		if (*cp == ' ')
+			cp++;
+	}
+	return caps;
+}
+
+static void cache_mdmon_caps(char *devname, int caps)
+{
+	snprintf(mdmon_caps_cache.devnm, sizeof(mdmon_caps_cache.devnm),
+		 "%s", devname);
+	mdmon_caps_cache.caps = caps;
+}
+
+/* Capabilities of the mdmon for @devname as last seen by
+ * check_mdmon_version() or mdmon_capabilities(), or -1 if unknown.
+ */
+int mdmon_cached_caps(char *devname)
+{
+	if (mdmon_caps_cache.caps < 0 ||
+	    strcmp(mdmon_caps_cache.devnm, devname) != 0)
+		return -1;
+	return mdmon_caps_cache.caps;
+}
+
+/* Ping mdmon over @sfd and return the MDMON_CAP_* flags it reports,
+ * 0 for an mdmon that predates them, or -1 on error.
+ */
+int mdmon_capabilities(int sfd, char *devname, int tmo)
+{
+	struct metadata_update msg;
+	int caps;
+
+	if (ack(sfd, tmo) != 0 || receive_message(sfd, &msg, tmo) != 0)
+		return -1;
+	caps = msg.len > 0 ? parse_mdmon_caps(&msg) : 0;
+	free(msg.buf);
+	cache_mdmon_caps(devname, caps);
+	return caps;
+}
+
 static char *ping_monitor_version(char *devname)
 {
 	int sfd = connect_monitor(devname);
@@ -242,6 +419,7 @@ static char *ping_monitor_version(char *devname)
 
 	if (err || !msg.len || !msg.buf)
 		return NULL;
+	cache_mdmon_caps(devname, parse_mdmon_caps(&msg));
 	return msg.buf;
 }
 
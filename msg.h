@@ -21,7 +21,14 @@ struct mdinfo;
 struct metadata_update;
 
 extern int receive_message(int fd, struct metadata_update *msg, int tmo);
+extern int receive_message_buf(int fd, struct metadata_update *msg, int *size,
+			       int tmo);
 extern int send_message(int fd, struct metadata_update *msg, int tmo);
+extern int send_message_batch(int fd, struct metadata_update *mu, int count,
+			      int tmo);
+extern int send_ping_reply(int fd, int tmo);
+extern int mdmon_capabilities(int sfd, char *devname, int tmo);
+extern int mdmon_cached_caps(char *devname);
 extern int ack(int fd, int tmo);
 extern int wait_reply(int fd, int tmo);
 extern int connect_monitor(char *devname);
@@ -35,3 +42,6 @@ extern int ping_manager(char *devname);
 extern void flush_mdmon(char *container);
 
 #define MSG_MAX_LEN (4*1024*1024)
+#define MSG_BATCH_MAX 64
+
+#define MDMON_CAP_BATCH 1
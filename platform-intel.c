@@ -94,6 +94,8 @@ struct imsm_level_ops imsm_level_ops[] = {
 
 static int devpath_to_ll(const char *dev_path, const char *entry,
 			 unsigned long long *val);
+static int platform_cache_load(void);
+static void platform_cache_save(void);
 
 static void free_sys_dev(struct sys_dev **list)
 {
@@ -411,6 +413,11 @@ struct sys_dev *find_intel_devices(void)
 	if (intel_devices)
 		free_sys_dev(&intel_devices);
 
+	if (platform_cache_load()) {
+		valid_time = time(0);
+		return intel_devices;
+	}
+
 	isci = find_driver_devices("pci", "isci");
 	/* Searching for AHCI will return list of SATA and SATA VMD controllers */
 	ahci = find_driver_devices("pci", "ahci");
@@ -436,6 +443,7 @@ struct sys_dev *find_intel_devices(void)
 	}
 	intel_devices = ahci;
 	valid_time = time(0);
+	platform_cache_save();
 	return intel_devices;
 }
 
@@ -517,6 +525,315 @@ static void add_orom_device_id(struct orom_entry *entry, __u16 dev_id)
 		prev->next = list;
 }
 
+/*
+ * Probing option ROMs, EFI variables, ACPI tables and VMD registers gives
+ * the same answer until the hardware changes, but would otherwise be done
+ * by every mdadm run, e.g. once per udev event.  The HBA list and the
+ * capabilities found for the HBAs are kept in MAP_DIR, tagged with the
+ * boot id and a fingerprint of the PCI devices and the driver bindings we
+ * look at; any change there makes the next run probe again.
+ * Only capabilities that were found are recorded: an early run may not be
+ * able to read EFI variables or option ROMs yet, so an HBA without one is
+ * probed again by every run.
+ */
+#define PLATFORM_CACHE		MAP_DIR "/imsm-platform"
+#define PLATFORM_CACHE_MAGIC	"IMSMPC02"
+#define PLATFORM_CACHE_MAX	(64 * 1024)
+
+unsigned long crc32(
+	unsigned long crc,
+	const unsigned char *buf,
+	unsigned len);
+
+/* csum covers everything after the header */
+struct platform_cache_hdr {
+	char magic[8];
+	char boot_id[40];
+	char version[80];
+	__u32 pci_hash;
+	__u32 ndevs;
+	__u32 noroms;
+	__u32 csum;
+};
+
+/* followed by path_len bytes of path */
+struct platform_cache_dev {
+	__u32 type;
+	__u32 class;
+	__u16 dev_id;
+	__u16 path_len;
+};
+
+/* followed by ndevids __u16 device ids */
+struct platform_cache_orom {
+	struct imsm_orom orom;
+	__u32 type;
+	__u32 ndevids;
+};
+
+/* set when intel_devices came from the cache, so new finds are added to it */
+static int platform_cache_loaded;
+
+static int platform_cache_disabled(void)
+{
+	return check_env("IMSM_NO_PLATFORM_CACHE") ||
+	       check_env("IMSM_TEST_OROM") ||
+	       check_env("IMSM_TEST_AHCI_EFI") ||
+	       check_env("IMSM_TEST_SCU_EFI");
+}
+
+static int read_boot_id(char *buf, int len)
+{
+	int fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY);
+	int n;
+
+	memset(buf, 0, len);
+	if (fd < 0)
+		return -1;
+	n = read(fd, buf, len - 1);
+	close(fd);
+	return n > 0 ? 0 : -1;
+}
+
+static __u32 pci_fingerprint(void)
+{
+	static const char * const dirs[] = {
+		"/sys/bus/pci/devices",
+		"/sys/bus/pci/drivers/ahci",
+		"/sys/bus/pci/drivers/isci",
+		"/sys/bus/pci/drivers/nvme",
+		"/sys/bus/pci/drivers/vmd",
+	};
+	__u32 sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(dirs); i++) {
+		DIR *dir = opendir(dirs[i]);
+		struct dirent *de;
+
+		if (!dir)
+			continue;
+		/* order independent: readdir order is not guaranteed */
+		while ((de = readdir(dir)) != NULL) {
+			__u32 h = 2166136261U ^ i;
+			char *c;
+
+			for (c = de->d_name; *c; c++)
+				h = (h ^ (unsigned char)*c) * 16777619U;
+			sum += h;
+		}
+		closedir(dir);
+	}
+	return sum;
+}
+
+static int platform_cache_load(void)
+{
+	struct platform_cache_hdr *hdr;
+	struct sys_dev *head = NULL, **tail = &head;
+	char boot_id[sizeof(hdr->boot_id)];
+	char *buf, *p, *end;
+	int fd, len;
+	__u32 i, j;
+
+	if (platform_cache_disabled() ||
+	    read_boot_id(boot_id, sizeof(boot_id)) != 0)
+		return 0;
+
+	fd = open(PLATFORM_CACHE, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	buf = xmalloc(PLATFORM_CACHE_MAX);
+	len = read(fd, buf, PLATFORM_CACHE_MAX);
+	close(fd);
+
+	hdr = (struct platform_cache_hdr *)buf;
+	if (len < (int)sizeof(*hdr) ||
+	    memcmp(hdr->magic, PLATFORM_CACHE_MAGIC, sizeof(hdr->magic)) ||
+	    strncmp(hdr->boot_id, boot_id, sizeof(hdr->boot_id)) ||
+	    strncmp(hdr->version, Version, sizeof(hdr->version) - 1) ||
+	    hdr->pci_hash != pci_fingerprint() ||
+	    hdr->csum != crc32(0, (unsigned char *)buf + sizeof(*hdr),
+			       len - sizeof(*hdr)))
+		goto fail;
+
+	p = buf + sizeof(*hdr);
+	end = buf + len;
+	for (i = 0; i < hdr->ndevs; i++) {
+		struct platform_cache_dev d;
+		struct sys_dev *dev;
+
+		if (p + sizeof(d) > end)
+			goto fail;
+		memcpy(&d, p, sizeof(d));
+		p += sizeof(d);
+		if (d.path_len == 0 || p + d.path_len > end)
+			goto fail;
+
+		dev = xcalloc(1, sizeof(*dev));
+		dev->path = xmalloc(d.path_len + 1);
+		memcpy(dev->path, p, d.path_len);
+		dev->path[d.path_len] = '\0';
+		p += d.path_len;
+		dev->type = d.type;
+		dev->class = d.class;
+		dev->dev_id = d.dev_id;
+		dev->pci_id = strrchr(dev->path, '/');
+		if (dev->pci_id)
+			dev->pci_id++;
+		*tail = dev;
+		tail = &dev->next;
+	}
+
+	/* validate the capability records before adding any of them */
+	for (i = 0, end = p; i < hdr->noroms; i++) {
+		struct platform_cache_orom o;
+
+		if (end + sizeof(o) > buf + len)
+			goto fail;
+		memcpy(&o, end, sizeof(o));
+		end += sizeof(o) + o.ndevids * sizeof(__u16);
+		if (end > buf + len)
+			goto fail;
+	}
+	/* entries already found by this process are kept as they are */
+	for (i = 0; i < hdr->noroms; i++) {
+		struct platform_cache_orom o;
+		struct orom_entry *entry = NULL;
+		__u16 devid;
+
+		memcpy(&o, p, sizeof(o));
+		p += sizeof(o);
+		for (j = 0; j < o.ndevids; j++, p += sizeof(devid)) {
+			memcpy(&devid, p, sizeof(devid));
+			if (get_orom_by_device_id(devid))
+				continue;
+			if (!entry) {
+				entry = add_orom(&o.orom);
+				entry->type = o.type;
+			}
+			add_orom_device_id(entry, devid);
+		}
+	}
+
+	free(buf);
+	intel_devices = head;
+	platform_cache_loaded = 1;
+	return 1;
+fail:
+	free(buf);
+	free_sys_dev(&head);
+	return 0;
+}
+
+/* write intel_devices and the capabilities found so far to the cache */
+static void platform_cache_write(void)
+{
+	char tmp[] = PLATFORM_CACHE ".XXXXXX";
+	struct platform_cache_hdr hdr;
+	struct sys_dev *hba;
+	struct orom_entry *entry;
+	struct devid_list *devid;
+	char *buf, *p;
+	int fd, ok;
+
+	if (platform_cache_disabled())
+		return;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PLATFORM_CACHE_MAGIC, sizeof(hdr.magic));
+	if (read_boot_id(hdr.boot_id, sizeof(hdr.boot_id)) != 0)
+		return;
+	strncpy(hdr.version, Version, sizeof(hdr.version) - 1);
+	hdr.pci_hash = pci_fingerprint();
+
+	buf = xmalloc(PLATFORM_CACHE_MAX);
+	p = buf + sizeof(hdr);
+	ok = 1;
+	for (hba = intel_devices; hba && ok; hba = hba->next) {
+		struct platform_cache_dev d = {
+			.type = hba->type,
+			.class = hba->class,
+			.dev_id = hba->dev_id,
+			.path_len = strlen(hba->path),
+		};
+
+		if (p + sizeof(d) + d.path_len > buf + PLATFORM_CACHE_MAX) {
+			ok = 0;
+			break;
+		}
+		memcpy(p, &d, sizeof(d));
+		p += sizeof(d);
+		memcpy(p, hba->path, d.path_len);
+		p += d.path_len;
+		hdr.ndevs++;
+	}
+	for (entry = orom_entries; entry && ok; entry = entry->next) {
+		struct platform_cache_orom o = {
+			.orom = entry->orom,
+			.type = entry->type,
+		};
+		char *rec = p;
+
+		if (p + sizeof(o) > buf + PLATFORM_CACHE_MAX) {
+			ok = 0;
+			break;
+		}
+		p += sizeof(o);
+		for (devid = entry->devid_list; devid; devid = devid->next) {
+			if (p + sizeof(__u16) > buf + PLATFORM_CACHE_MAX) {
+				ok = 0;
+				break;
+			}
+			memcpy(p, &devid->devid, sizeof(__u16));
+			p += sizeof(__u16);
+			o.ndevids++;
+		}
+		memcpy(rec, &o, sizeof(o));
+		hdr.noroms++;
+	}
+	if (!ok) {
+		free(buf);
+		return;
+	}
+	hdr.csum = crc32(0, (unsigned char *)buf + sizeof(hdr),
+			 p - buf - sizeof(hdr));
+	memcpy(buf, &hdr, sizeof(hdr));
+
+	/* a private temporary file, concurrent runs may be saving too */
+	(void)mkdir(MAP_DIR, 0755);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		free(buf);
+		return;
+	}
+	if (fchmod(fd, 0644) == 0 && write(fd, buf, p - buf) == p - buf) {
+		close(fd);
+		if (rename(tmp, PLATFORM_CACHE) == 0) {
+			free(buf);
+			return;
+		}
+	} else
+		close(fd);
+	unlink(tmp);
+	free(buf);
+}
+
+static void platform_cache_save(void)
+{
+	struct sys_dev *hba;
+
+	platform_cache_loaded = 0;
+	if (platform_cache_disabled())
+		return;
+
+	/* look up every HBA now so that later runs need not */
+	for (hba = intel_devices; hba; hba = hba->next)
+		find_imsm_capability(hba);
+
+	platform_cache_write();
+}
+
 static int scan(const void *start, const void *end, const void *data)
 {
 	int offset;
@@ -1206,12 +1523,9 @@ const struct imsm_orom *find_imsm_vmd(struct sys_dev *hba)
 	return &vmd_orom->orom;
 }
 
-const struct imsm_orom *find_imsm_capability(struct sys_dev *hba)
+static const struct imsm_orom *probe_imsm_capability(struct sys_dev *hba)
 {
-	const struct imsm_orom *cap = get_orom_by_device_id(hba->dev_id);
-
-	if (cap)
-		return cap;
+	const struct imsm_orom *cap;
 
 	if (hba->type == SYS_DEV_NVME)
 		return find_imsm_nvme(hba);
@@ -1233,6 +1547,22 @@ const struct imsm_orom *find_imsm_capability(struct sys_dev *hba)
 	return NULL;
 }
 
+const struct imsm_orom *find_imsm_capability(struct sys_dev *hba)
+{
+	const struct imsm_orom *cap = get_orom_by_device_id(hba->dev_id);
+
+	if (cap)
+		return cap;
+
+	cap = probe_imsm_capability(hba);
+
+	/* the cache missed it, record it for the next runs */
+	if (cap && platform_cache_loaded)
+		platform_cache_write();
+
+	return cap;
+}
+
 /* Check whether the nvme device is represented by nvme subsytem,
  * if yes virtual path should be changed to hardware device path,
  * to allow IMSM capabilities detection.
@@ -191,38 +191,98 @@ struct dev_policy *pol_find(struct dev_policy *pol, char *name)
 	return pol;
 }
 
-static char **disk_paths(struct mdinfo *disk)
+/*
+ * Scanning /dev/disk/by-path means a readdir() and a stat() of every
+ * link, which is far too expensive to repeat for each device we are
+ * asked about.  So the directory is read once and kept as a table
+ * sorted by device number, until policy_cache_flush() is called.
+ */
+struct by_path_ent {
+	dev_t rdev;
+	char *name;
+};
+
+static struct by_path_ent *by_path_table;
+static int by_path_cnt = -1;
+
+static int by_path_cmp(const void *av, const void *bv)
+{
+	const struct by_path_ent *a = av, *b = bv;
+
+	if (a->rdev < b->rdev)
+		return -1;
+	if (a->rdev > b->rdev)
+		return 1;
+	return strcmp(a->name, b->name);
+}
+
+static void by_path_load(void)
 {
 	struct stat stb;
 	int prefix_len;
 	DIR *by_path;
 	char symlink[PATH_MAX] = "/dev/disk/by-path/";
-	char **paths;
-	int cnt = 0;
 	struct dirent *ent;
+	int alloc = 0;
 
-	paths = xmalloc(sizeof(*paths) * (cnt+1));
-
+	by_path_cnt = 0;
 	by_path = opendir(symlink);
-	if (by_path) {
-		prefix_len = strlen(symlink);
-		while ((ent = readdir(by_path)) != NULL) {
-			if (ent->d_type != DT_LNK)
-				continue;
-			strncpy(symlink + prefix_len,
-					ent->d_name,
-					sizeof(symlink) - prefix_len);
-			if (stat(symlink, &stb) < 0)
-				continue;
-			if ((stb.st_mode & S_IFMT) != S_IFBLK)
-				continue;
-			if (stb.st_rdev != makedev(disk->disk.major, disk->disk.minor))
-				continue;
-			paths[cnt++] = xstrdup(ent->d_name);
-			paths = xrealloc(paths, sizeof(*paths) * (cnt+1));
+	if (!by_path)
+		return;
+
+	prefix_len = strlen(symlink);
+	while ((ent = readdir(by_path)) != NULL) {
+		if (ent->d_type != DT_LNK)
+			continue;
+		strncpy(symlink + prefix_len,
+				ent->d_name,
+				sizeof(symlink) - prefix_len);
+		if (stat(symlink, &stb) < 0)
+			continue;
+		if ((stb.st_mode & S_IFMT) != S_IFBLK)
+			continue;
+		if (by_path_cnt == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			by_path_table = xrealloc(by_path_table,
+						 sizeof(*by_path_table) * alloc);
 		}
-		closedir(by_path);
+		by_path_table[by_path_cnt].rdev = stb.st_rdev;
+		by_path_table[by_path_cnt].name = xstrdup(ent->d_name);
+		by_path_cnt++;
+	}
+	closedir(by_path);
+
+	if (by_path_cnt)
+		qsort(by_path_table, by_path_cnt, sizeof(*by_path_table),
+		      by_path_cmp);
+}
+
+static char **disk_paths(struct mdinfo *disk)
+{
+	dev_t rdev = makedev(disk->disk.major, disk->disk.minor);
+	char **paths;
+	int lo = 0, hi, i;
+	int cnt = 0;
+
+	if (by_path_cnt < 0)
+		by_path_load();
+
+	/* find the first entry for rdev */
+	hi = by_path_cnt;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (by_path_table[mid].rdev < rdev)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+	for (i = lo; i < by_path_cnt && by_path_table[i].rdev == rdev; i++)
+		cnt++;
+
+	paths = xmalloc(sizeof(*paths) * (cnt+1));
+	for (i = 0; i < cnt; i++)
+		paths[i] = xstrdup(by_path_table[lo + i].name);
 	paths[cnt] = NULL;
 	return paths;
 }
@@ -259,6 +319,30 @@ static int path_has_part(char *path, char **part)
 	return 1;
 }
 
+/*
+ * path= values are globs, but nearly always of the form
+ * "pci-0000:00:1f.2-ata-*" - a long literal prefix followed by a
+ * little bit of pattern.  When the rule is read we note how long the
+ * literal prefix is and whether there is any pattern at all, so that
+ * most candidate paths can be rejected (or accepted) with a simple
+ * string compare and fnmatch() is only used for what remains.
+ */
+static void rule_compile(struct rule *r)
+{
+	r->prefix_len = strcspn(r->value, "*?[\\");
+	r->literal = r->value[r->prefix_len] == '\0';
+}
+
+static int rule_path_match(struct rule *rule, char *path)
+{
+	if (strncmp(rule->value, path, rule->prefix_len) != 0)
+		return 0;
+	if (rule->literal)
+		return path[rule->prefix_len] == '\0';
+	return fnmatch(rule->value + rule->prefix_len,
+		       path + rule->prefix_len, 0) == 0;
+}
+
 static int pol_match(struct rule *rule, char **paths, char *type, char **part)
 {
 	/* Check if this rule matches on any path and type.
@@ -283,7 +367,7 @@ static int pol_match(struct rule *rule, char **paths, char *type, char **part)
 					*p = '\0';
 					*part = p+1;
 				}
-				if (fnmatch(rule->value, paths[i], 0) == 0)
+				if (rule_path_match(rule, paths[i]))
 					pathok = 1;
 				if (part)
 					*p = '-';
@@ -500,23 +584,86 @@ static void free_paths(char **paths)
 	free(paths);
 }
 
+/*
+ * The policy of a given device doesn't change unless the config or
+ * the set of devices changes, and the same device is often asked about
+ * many times (once per candidate array in Incremental or Monitor), so
+ * the result is remembered per device number.  Callers own and may
+ * modify what we return, so they always get a copy.
+ */
+struct policy_cache_ent {
+	struct policy_cache_ent *next;
+	dev_t rdev;
+	struct dev_policy *pol;
+};
+
+static struct policy_cache_ent *policy_cache;
+
+static struct dev_policy *pol_dup(struct dev_policy *pol)
+{
+	struct dev_policy *new = NULL, **np = &new;
+
+	for (; pol; pol = pol->next) {
+		*np = xmalloc(sizeof(**np));
+		**np = *pol;
+		np = &(*np)->next;
+	}
+	*np = NULL;
+	return new;
+}
+
+/*
+ * policy_cache_flush() - forget everything learnt about devices.
+ *
+ * Long running callers (Monitor) must call this whenever devices
+ * may have come or gone.
+ */
+void policy_cache_flush(void)
+{
+	int i;
+
+	while (policy_cache) {
+		struct policy_cache_ent *pc = policy_cache;
+
+		policy_cache = pc->next;
+		dev_policy_free(pc->pol);
+		free(pc);
+	}
+
+	for (i = 0; i < by_path_cnt; i++)
+		free(by_path_table[i].name);
+	free(by_path_table);
+	by_path_table = NULL;
+	by_path_cnt = -1;
+}
+
 /*
  * disk_policy() gathers policy information for the
  * disk described in the given mdinfo (disk.{major,minor}).
  */
 struct dev_policy *disk_policy(struct mdinfo *disk)
 {
+	dev_t rdev = makedev(disk->disk.major, disk->disk.minor);
+	struct policy_cache_ent *pc;
 	char **paths = NULL;
-	char *type = disk_type(disk);
-	struct dev_policy *pol = NULL;
+	char *type;
 
+	for (pc = policy_cache; pc; pc = pc->next)
+		if (pc->rdev == rdev)
+			return pol_dup(pc->pol);
+
+	type = disk_type(disk);
 	if (config_rules_has_path)
 		paths = disk_paths(disk);
 
-	pol = path_policy(paths, type);
+	pc = xmalloc(sizeof(*pc));
+	pc->rdev = rdev;
+	pc->pol = path_policy(paths, type);
+	pc->next = policy_cache;
+	policy_cache = pc;
 
 	free_paths(paths);
-	return pol;
+	return pol_dup(pc->pol);
 }
 
 struct dev_policy *devid_policy(int dev)
@@ -554,6 +701,7 @@ static int try_rule(char *w, char *name, struct rule **rp)
 	r->name = name;
 	r->value = xstrdup(w+len+1);
 	r->dups = NULL;
+	rule_compile(r);
 	*rp = r;
 	return 1;
 }
@@ -582,6 +730,7 @@ void policyline(char *line, char *type)
 	}
 	pr->next = config_rules;
 	config_rules = pr;
+	policy_cache_flush();
 }
 
 void policy_add(char *type, ...)
@@ -604,10 +753,12 @@ void policy_add(char *type, ...)
 		r->name = name;
 		r->value = xstrdup(val);
 		r->dups = NULL;
+		rule_compile(r);
 		pr->rule = r;
 	}
 	pr->next = config_rules;
 	config_rules = pr;
+	policy_cache_flush();
 	va_end(ap);
 }
 
@@ -631,6 +782,7 @@ void policy_free(void)
 	}
 	config_rules_end = NULL;
 	config_rules_has_path = 0;
+	policy_cache_flush();
 }
 
 void dev_policy_free(struct dev_policy *p)
@@ -428,6 +428,26 @@ struct bad_block_log {
 	} entries[0];
 };
 
+/* Open addressed map from a phys refnum or a virtual disk guid to its
+ * index in ->phys or ->virt.  The tables are changed in place all over
+ * this file, so slots are only hints: a hit is checked against the table
+ * and a miss falls back to a scan, which records what it finds.
+ */
+struct ddf_index {
+	unsigned int mask;
+	unsigned int used;
+	unsigned int slot[];	/* DDF_NOTFOUND when empty */
+};
+
+/* Parts of the DDF structure written after the header.  The headers are
+ * always rewritten, each section only when it is marked dirty.
+ */
+#define DDF_SECT_CONTROLLER	(1 << 0)
+#define DDF_SECT_PHYS		(1 << 1)
+#define DDF_SECT_VIRT		(1 << 2)
+#define DDF_SECT_CONF		(1 << 3) /* config records and disk data */
+#define DDF_SECT_ALL		((1 << 4) - 1)
+
 /* Struct for internally holding ddf structures */
 /* The DDF structure stored on each device is potentially
  * quite different, as some data is global and some is local.
@@ -460,6 +480,8 @@ struct ddf_super {
 	unsigned int		max_part, mppe, conf_rec_len;
 	int			currentdev;
 	int			updates_pending;
+	unsigned int		dirty; /* DDF_SECT_* to write on next sync */
+	struct ddf_index	*pd_index, *vd_index;
 	struct vcl {
 		union {
 			char space[512];
@@ -518,6 +540,7 @@ static int validate_geometry_ddf_bvd(struct supertype *st,
 				     int verbose);
 
 static void free_super_ddf(struct supertype *st);
+static void ddf_build_index(struct ddf_super *ddf);
 static int all_ff(const char *guid);
 static unsigned int get_pd_index_from_refnum(const struct vcl *vc,
 					     be32 refnum, unsigned int nmax,
@@ -553,11 +576,13 @@ static void pr_state(const struct ddf_super *ddf, const char *msg) {}
 #endif
 
 static void _ddf_set_updates_pending(struct ddf_super *ddf, struct vd_config *vc,
-				     const char *func)
+				     unsigned int sections, const char *func)
 {
+	ddf->dirty |= sections;
 	if (vc) {
 		vc->timestamp = cpu_to_be32(time(0)-DECADE);
 		vc->seqnum = cpu_to_be32(be32_to_cpu(vc->seqnum) + 1);
+		ddf->dirty |= DDF_SECT_CONF;
 	}
 	if (ddf->updates_pending)
 		return;
@@ -566,7 +591,11 @@ static void _ddf_set_updates_pending(struct ddf_super *ddf, struct vd_config *vc
 	pr_state(ddf, func);
 }
 
-#define ddf_set_updates_pending(x,v) _ddf_set_updates_pending((x), (v), __func__)
+#define ddf_set_updates_pending(x,v) \
+	_ddf_set_updates_pending((x), (v), DDF_SECT_ALL, __func__)
+/* as above, when only the given DDF_SECT_* sections were changed */
+#define ddf_set_sections_pending(x,v,s) \
+	_ddf_set_updates_pending((x), (v), (s), __func__)
 
 static be32 calc_crc(void *buf, int len)
 {
@@ -1129,6 +1158,7 @@ static int load_ddf_global(int fd, struct ddf_super *super, char *devname)
 	super->max_part = be16_to_cpu(super->active->max_partitions);
 	super->mppe = be16_to_cpu(super->active->max_primary_element_entries);
 	super->conf_rec_len = be16_to_cpu(super->active->config_record_len);
+	ddf_build_index(super);
 	return 0;
 }
 
@@ -1399,6 +1429,8 @@ static void free_super_ddf(struct supertype *st)
 		return;
 	free(ddf->phys);
 	free(ddf->virt);
+	free(ddf->pd_index);
+	free(ddf->vd_index);
 	free(ddf->conf);
 	while (ddf->conflist) {
 		struct vcl *v = ddf->conflist;
@@ -1833,6 +1865,7 @@ static int copy_metadata_ddf(struct supertype *st, int from, int to)
 	int bytes;
 	struct ddf_header *ddf;
 	int written = 0;
+	const int bufsize = 1024*1024;
 
 	/* The meta consists of an anchor, a primary, and a secondary.
 	 * This all lives at the end of the device.
@@ -1843,7 +1876,7 @@ static int copy_metadata_ddf(struct supertype *st, int from, int to)
 	 * we choose one of those
 	 */
 
-	if (posix_memalign(&buf, 4096, 4096) != 0)
+	if (posix_memalign(&buf, 4096, bufsize) != 0)
 		return 1;
 
 	if (!get_dev_size(from, NULL, &dsize))
@@ -1875,8 +1908,8 @@ static int copy_metadata_ddf(struct supertype *st, int from, int to)
 
 	while (written < bytes) {
 		int n = bytes - written;
-		if (n > 4096)
-			n = 4096;
+		if (n > bufsize)
+			n = bufsize;
 		if (read(from, buf, n) != n)
 			goto err;
 		if (write(to, buf, n) != n)
@@ -2066,15 +2099,114 @@ bad:
 	return NULL;
 }
 
+static struct ddf_index *ddf_index_alloc(unsigned int entries)
+{
+	struct ddf_index *ix;
+	unsigned int size = 16;
+
+	while (size < entries * 2)
+		size <<= 1;
+	ix = xmalloc(sizeof(*ix) + size * sizeof(ix->slot[0]));
+	ix->mask = size - 1;
+	ix->used = 0;
+	memset(ix->slot, 0xff, size * sizeof(ix->slot[0]));
+	return ix;
+}
+
+/* note that the key hashing to 'h' is at 'index' */
+static void ddf_index_add(struct ddf_index *ix, unsigned int h,
+			  unsigned int index)
+{
+	unsigned int n;
+
+	if (!ix)
+		return;
+	if (ix->used * 4 >= (ix->mask + 1) * 3) {
+		/* mostly stale hints by now, start over */
+		memset(ix->slot, 0xff, (ix->mask + 1) * sizeof(ix->slot[0]));
+		ix->used = 0;
+	}
+	for (n = 0; n <= ix->mask; n++) {
+		unsigned int *slot = &ix->slot[(h + n) & ix->mask];
+
+		if (*slot == index)
+			return;
+		if (*slot == DDF_NOTFOUND) {
+			*slot = index;
+			ix->used++;
+			return;
+		}
+	}
+}
+
+static unsigned int ddf_refnum_hash(be32 refnum)
+{
+	return be32_to_cpu(refnum) * 2654435761u;
+}
+
+static unsigned int ddf_guid_hash(const char *guid)
+{
+	unsigned int h = 2166136261u;
+	int i;
+
+	for (i = 0; i < DDF_GUID_LEN; i++)
+		h = (h ^ (unsigned char)guid[i]) * 16777619u;
+	return h;
+}
+
+static void ddf_build_index(struct ddf_super *ddf)
+{
+	unsigned int max_pdes = be16_to_cpu(ddf->phys->max_pdes);
+	unsigned int max_vdes = be16_to_cpu(ddf->virt->max_vdes);
+	unsigned int i;
+
+	free(ddf->pd_index);
+	free(ddf->vd_index);
+	ddf->pd_index = ddf_index_alloc(max_pdes);
+	ddf->vd_index = ddf_index_alloc(max_vdes);
+
+	/* in table order, so the first of any duplicates wins the probe */
+	for (i = 0; i < max_pdes; i++) {
+		be32 refnum = ddf->phys->entries[i].refnum;
+
+		if (be32_to_cpu(refnum) != 0xffffffff)
+			ddf_index_add(ddf->pd_index, ddf_refnum_hash(refnum), i);
+	}
+	for (i = 0; i < max_vdes; i++) {
+		const char *guid = ddf->virt->entries[i].guid;
+
+		if (!all_ff(guid))
+			ddf_index_add(ddf->vd_index, ddf_guid_hash(guid), i);
+	}
+}
+
 static int find_phys(const struct ddf_super *ddf, be32 phys_refnum)
 {
 	/* Find the entry in phys_disk which has the given refnum
 	 * and return it's index
 	 */
-	unsigned int i;
-	for (i = 0; i < be16_to_cpu(ddf->phys->max_pdes); i++)
-		if (be32_eq(ddf->phys->entries[i].refnum, phys_refnum))
+	struct ddf_index *ix = ddf->pd_index;
+	unsigned int max = be16_to_cpu(ddf->phys->max_pdes);
+	unsigned int h = ddf_refnum_hash(phys_refnum);
+	unsigned int i, n;
+
+	if (be32_to_cpu(phys_refnum) == 0xffffffff)
+		ix = NULL;
+
+	for (n = 0; ix && n <= ix->mask; n++) {
+		i = ix->slot[(h + n) & ix->mask];
+		if (i == DDF_NOTFOUND)
+			break;
+		if (i < max && be32_eq(ddf->phys->entries[i].refnum,
+				       phys_refnum))
+			return i;
+	}
+
+	for (i = 0; i < max; i++)
+		if (be32_eq(ddf->phys->entries[i].refnum, phys_refnum)) {
+			ddf_index_add(ix, h, i);
 			return i;
+		}
 	return -1;
 }
 
@@ -2359,12 +2491,28 @@ static unsigned int find_vde_by_name(const struct ddf_super *ddf,
 static unsigned int find_vde_by_guid(const struct ddf_super *ddf,
 				     const char *guid)
 {
-	unsigned int i;
+	struct ddf_index *ix = ddf->vd_index;
+	unsigned int max = be16_to_cpu(ddf->virt->max_vdes);
+	unsigned int i, n, h;
+
 	if (guid == NULL || all_ff(guid))
 		return DDF_NOTFOUND;
-	for (i = 0; i < be16_to_cpu(ddf->virt->max_vdes); i++)
-		if (!memcmp(ddf->virt->entries[i].guid, guid, DDF_GUID_LEN))
+
+	h = ddf_guid_hash(guid);
+	for (n = 0; ix && n <= ix->mask; n++) {
+		i = ix->slot[(h + n) & ix->mask];
+		if (i == DDF_NOTFOUND)
+			break;
+		if (i < max &&
+		    !memcmp(ddf->virt->entries[i].guid, guid, DDF_GUID_LEN))
+			return i;
+	}
+
+	for (i = 0; i < max; i++)
+		if (!memcmp(ddf->virt->entries[i].guid, guid, DDF_GUID_LEN)) {
+			ddf_index_add(ix, h, i);
 			return i;
+		}
 	return DDF_NOTFOUND;
 }
 
@@ -2576,6 +2724,7 @@ static int init_super_ddf(struct supertype *st,
 	for (i=0; i<max_virt_disks; i++)
 		memset(&vd->entries[i], 0xff, sizeof(struct virtual_entry));
 
+	ddf_build_index(ddf);
 	st->sb = ddf;
 	ddf_set_updates_pending(ddf, NULL);
 	return 1;
@@ -3102,7 +3251,17 @@ static int remove_from_super_ddf(struct supertype *st, mdu_disk_info_t *dk)
  * container.
  */
 
-static int __write_ddf_structure(struct dl *d, struct ddf_super *ddf, __u8 type)
+/* write 'len' bytes of a section if it is in 'sections', else skip it */
+static int write_ddf_section(int fd, void *buf, int len, unsigned int sect,
+			     unsigned int sections)
+{
+	if (!(sections & sect))
+		return lseek64(fd, len, SEEK_CUR) == -1L ? -1 : 0;
+	return write(fd, buf, len) == len ? 0 : -1;
+}
+
+static int __write_ddf_structure(struct dl *d, struct ddf_super *ddf, __u8 type,
+				 unsigned int sections)
 {
 	unsigned long long sector;
 	struct ddf_header *header;
@@ -3137,17 +3296,28 @@ static int __write_ddf_structure(struct dl *d, struct ddf_super *ddf, __u8 type)
 	if (write(fd, header, 512) < 0)
 		goto out;
 
-	ddf->controller.crc = calc_crc(&ddf->controller, 512);
-	if (write(fd, &ddf->controller, 512) < 0)
+	if (sections & DDF_SECT_CONTROLLER)
+		ddf->controller.crc = calc_crc(&ddf->controller, 512);
+	if (write_ddf_section(fd, &ddf->controller, 512,
+			      DDF_SECT_CONTROLLER, sections) < 0)
+		goto out;
+
+	if (sections & DDF_SECT_PHYS)
+		ddf->phys->crc = calc_crc(ddf->phys, ddf->pdsize);
+	if (write_ddf_section(fd, ddf->phys, ddf->pdsize,
+			      DDF_SECT_PHYS, sections) < 0)
 		goto out;
 
-	ddf->phys->crc = calc_crc(ddf->phys, ddf->pdsize);
-	if (write(fd, ddf->phys, ddf->pdsize) < 0)
+	if (sections & DDF_SECT_VIRT)
+		ddf->virt->crc = calc_crc(ddf->virt, ddf->vdsize);
+	if (write_ddf_section(fd, ddf->virt, ddf->vdsize,
+			      DDF_SECT_VIRT, sections) < 0)
 		goto out;
 
-	ddf->virt->crc = calc_crc(ddf->virt, ddf->vdsize);
-	if (write(fd, ddf->virt, ddf->vdsize) < 0)
+	if (!(sections & DDF_SECT_CONF)) {
+		ret = 1;
 		goto out;
+	}
 
 	/* Now write lots of config records. */
 	n_config = ddf->max_part;
@@ -3207,7 +3377,8 @@ out:
 	return ret;
 }
 
-static int _write_super_to_disk(struct ddf_super *ddf, struct dl *d)
+static int _write_super_to_disk(struct ddf_super *ddf, struct dl *d,
+				unsigned int sections)
 {
 	unsigned long long size;
 	int fd = d->fd;
@@ -3247,10 +3418,10 @@ static int _write_super_to_disk(struct ddf_super *ddf, struct dl *d)
 	ddf->anchor.seq = cpu_to_be32(0xFFFFFFFF); /* no sequencing in anchor */
 	ddf->anchor.crc = calc_crc(&ddf->anchor, 512);
 
-	if (!__write_ddf_structure(d, ddf, DDF_HEADER_PRIMARY))
+	if (!__write_ddf_structure(d, ddf, DDF_HEADER_PRIMARY, sections))
 		return 0;
 
-	if (!__write_ddf_structure(d, ddf, DDF_HEADER_SECONDARY))
+	if (!__write_ddf_structure(d, ddf, DDF_HEADER_SECONDARY, sections))
 		return 0;
 
 	if (lseek64(fd, (size - 1) * 512, SEEK_SET) == -1L)
@@ -3262,7 +3433,7 @@ static int _write_super_to_disk(struct ddf_super *ddf, struct dl *d)
 	return 1;
 }
 
-static int __write_init_super_ddf(struct supertype *st)
+static int __write_init_super_ddf(struct supertype *st, unsigned int sections)
 {
 	struct ddf_super *ddf = st->sb;
 	struct dl *d;
@@ -3276,7 +3447,7 @@ static int __write_init_super_ddf(struct supertype *st)
 	 */
 	for (d = ddf->dlist; d; d=d->next) {
 		attempts++;
-		successes += _write_super_to_disk(ddf, d);
+		successes += _write_super_to_disk(ddf, d, sections);
 	}
 
 	return attempts != successes;
@@ -3340,7 +3511,7 @@ static int write_init_super_ddf(struct supertype *st)
 		/* Note: we don't close the fd's now, but a subsequent
 		 * ->free_super() will
 		 */
-		return __write_init_super_ddf(st);
+		return __write_init_super_ddf(st, DDF_SECT_ALL);
 	}
 }
 
@@ -4039,7 +4210,7 @@ static int store_super_ddf(struct supertype *st, int fd)
 		}
 		ofd = dl->fd;
 		dl->fd = fd;
-		ret = (_write_super_to_disk(ddf, dl) != 1);
+		ret = (_write_super_to_disk(ddf, dl, DDF_SECT_ALL) != 1);
 		dl->fd = ofd;
 		return ret;
 	}
@@ -4275,7 +4446,7 @@ static void handle_missing(struct ddf_super *ddf, struct active_array *a, int in
 			be16_set(ddf->phys->entries[pd].state,
 				 cpu_to_be16(DDF_Failed|DDF_Missing));
 			vc->phys_refnum[n_bvd] = cpu_to_be32(0);
-			ddf_set_updates_pending(ddf, vc);
+			ddf_set_sections_pending(ddf, vc, DDF_SECT_PHYS);
 		}
 
 		/* Mark the array as Degraded */
@@ -4287,7 +4458,7 @@ static void handle_missing(struct ddf_super *ddf, struct active_array *a, int in
 				(ddf->virt->entries[inst].state & ~DDF_state_mask)
 				| state;
 			a->check_degraded = 1;
-			ddf_set_updates_pending(ddf, vc);
+			ddf_set_sections_pending(ddf, vc, DDF_SECT_VIRT);
 		}
 	}
 }
@@ -4317,7 +4488,7 @@ static int ddf_set_array_state(struct active_array *a, int consistent)
 	else
 		ddf->virt->entries[inst].state |= DDF_state_inconsistent;
 	if (old != ddf->virt->entries[inst].state)
-		ddf_set_updates_pending(ddf, NULL);
+		ddf_set_sections_pending(ddf, NULL, DDF_SECT_VIRT);
 
 	old = ddf->virt->entries[inst].init_state;
 	ddf->virt->entries[inst].init_state &= ~DDF_initstate_mask;
@@ -4328,7 +4499,7 @@ static int ddf_set_array_state(struct active_array *a, int consistent)
 	else
 		ddf->virt->entries[inst].init_state |= DDF_init_quick;
 	if (old != ddf->virt->entries[inst].init_state)
-		ddf_set_updates_pending(ddf, NULL);
+		ddf_set_sections_pending(ddf, NULL, DDF_SECT_VIRT);
 
 	dprintf("ddf mark %d/%s (%d) %s %llu\n", inst,
 		guid_str(ddf->virt->entries[inst].guid), a->curr_state,
@@ -4539,24 +4710,27 @@ static void ddf_set_disk(struct active_array *a, int n, int state)
 		update = 1;
 	}
 	if (update)
-		ddf_set_updates_pending(ddf, vc);
+		ddf_set_sections_pending(ddf, vc, DDF_SECT_PHYS | DDF_SECT_VIRT);
 }
 
 static void ddf_sync_metadata(struct supertype *st)
 {
 	/*
-	 * Write all data to all devices.
-	 * Later, we might be able to track whether only local changes
-	 * have been made, or whether any global data has been changed,
-	 * but ddf is sufficiently weird that it probably always
-	 * changes global data ....
+	 * Write the headers and the sections changed since the last sync
+	 * to all devices.  If any device failed, write everything next time
+	 * so it cannot be left with a mix of old and new sections.
 	 */
 	struct ddf_super *ddf = st->sb;
+	unsigned int sections;
+
 	if (!ddf->updates_pending)
 		return;
 	ddf->updates_pending = 0;
-	__write_init_super_ddf(st);
-	dprintf("ddf: sync_metadata\n");
+	sections = ddf->dirty;
+	ddf->dirty = 0;
+	if (__write_init_super_ddf(st, sections))
+		ddf->dirty = DDF_SECT_ALL;
+	dprintf("ddf: sync_metadata %x\n", sections);
 }
 
 static int del_from_conflist(struct vcl **list, const char *guid)
@@ -32,6 +32,7 @@
 #include <scsi/sg.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/wait.h>
 #include <values.h>
 
 /* MPB == Metadata Parameter Block */
@@ -461,6 +462,10 @@ enum action {
 	DISK_REMOVE = 1,
 	DISK_ADD
 };
+
+/* slots in the serial number hash of struct imsm_lookup, a power of 2 */
+#define IMSM_SERIAL_HASH_SIZE 512
+
 /* internal representation of IMSM metadata */
 struct intel_super {
 	union {
@@ -497,6 +502,18 @@ struct intel_super {
 		int raiddisk; /* slot to fill in autolayout */
 		enum action action;
 	} *disks, *current_disk;
+	/* direct lookup of 'devlist' by index and of 'disks' by index and
+	 * serial.  Rebuilt by imsm_rebuild_lookup() once the metadata is
+	 * parsed or an update applied; entries are checked against the
+	 * key on use and a miss falls back to walking the list, so only
+	 * unlinking from the lists needs imsm_invalidate_lookup().
+	 */
+	struct imsm_lookup {
+		int valid;
+		struct intel_dev *dev[256];
+		struct dl *disk[IMSM_MAX_DEVICES];
+		struct dl *serial[IMSM_SERIAL_HASH_SIZE];
+	} lookup;
 	struct dl *disk_mgmt_list; /* list of disks to add/remove while mdmon
 				      active */
 	struct dl *missing; /* disks removed while we weren't looking */
@@ -507,6 +524,11 @@ struct intel_super {
 	struct md_bb bb;	/* memory for get_bad_blocks call */
 };
 
+static void imsm_invalidate_lookup(struct intel_super *super)
+{
+	super->lookup.valid = 0;
+}
+
 struct intel_disk {
 	struct imsm_disk disk;
 	#define IMSM_UNKNOWN_OWNER (-1)
@@ -864,9 +886,17 @@ static struct dl *get_imsm_dl_disk(struct intel_super *super, __u8 index)
 {
 	struct dl *d;
 
+	if (super->lookup.valid && index < IMSM_MAX_DEVICES) {
+		d = super->lookup.disk[index];
+		if (d && d->index == index)
+			return d;
+	}
+
 	for (d = super->disks; d; d = d->next)
-		if (d->index == index)
+		if (d->index == index) {
+			super->lookup.valid = 0;
 			return d;
+		}
 
 	return NULL;
 }
@@ -882,23 +912,59 @@ static struct imsm_disk *get_imsm_disk(struct intel_super *super, __u8 index)
 	return NULL;
 }
 
+#if BYTE_ORDER == LITTLE_ENDIAN
+typedef __u32 imsm_sum_vec __attribute__((vector_size(16)));
+#endif
+
+/* additive sum of 'words' little endian 32 bit words */
+static __u32 imsm_sum32(const void *buf, __u32 words)
+{
+	const char *p = buf;
+	__u32 sum = 0;
+	__u32 i = 0;
+
+#if BYTE_ORDER == LITTLE_ENDIAN
+	/* four lanes at a time, the compiler maps this onto SIMD adds where
+	 * the target has them
+	 */
+	imsm_sum_vec acc = {0, 0, 0, 0};
+
+	for (; i + 4 <= words; i += 4) {
+		imsm_sum_vec v;
+
+		memcpy(&v, p + i * sizeof(__u32), sizeof(v));
+		acc += v;
+	}
+	sum = acc[0] + acc[1] + acc[2] + acc[3];
+#endif
+	for (; i < words; i++) {
+		__u32 w;
+
+		memcpy(&w, p + i * sizeof(__u32), sizeof(w));
+		sum += __le32_to_cpu(w);
+	}
+
+	return sum;
+}
+
 /* generate a checksum directly from the anchor when the anchor is known to be
  * up-to-date, currently only at load or write_super after coalescing
  */
 static __u32 __gen_imsm_checksum(struct imsm_super *mpb)
 {
-	__u32 end = mpb->mpb_size / sizeof(end);
-	__u32 *p = (__u32 *) mpb;
-	__u32 sum = 0;
-
-	while (end--) {
-		sum += __le32_to_cpu(*p);
-		p++;
-	}
+	__u32 sum = imsm_sum32(mpb, mpb->mpb_size / sizeof(__u32));
 
 	return sum - __le32_to_cpu(mpb->check_sum);
 }
 
+/* adjust a checksum from __gen_imsm_checksum() for a 32 bit field of the
+ * mpb changing from 'old' to 'new' (both little endian)
+ */
+static __u32 imsm_checksum_delta(__u32 sum, __u32 old, __u32 new)
+{
+	return sum - __le32_to_cpu(old) + __le32_to_cpu(new);
+}
+
 static size_t sizeof_imsm_map(struct imsm_map *map)
 {
 	return sizeof(struct imsm_map) + sizeof(__u32) * (map->num_members - 1);
@@ -1021,9 +1087,17 @@ static struct imsm_dev *get_imsm_dev(struct intel_super *super, __u8 index)
 	if (index >= super->anchor->num_raid_devs)
 		goto error;
 
+	if (super->lookup.valid) {
+		dv = super->lookup.dev[index];
+		if (dv && dv->index == index)
+			return dv->dev;
+	}
+
 	for (dv = super->devlist; dv; dv = dv->next)
-		if (dv->index == index)
+		if (dv->index == index) {
+			super->lookup.valid = 0;
 			return dv->dev;
+		}
 error:
 	pr_err("cannot find imsm_dev with index %u in intel_super\n", index);
 	abort();
@@ -1056,22 +1130,93 @@ static __u32 get_imsm_bbm_log_size(struct bbm_log *log)
 		log->entry_count * sizeof(struct bbm_log_entry);
 }
 
+/* The in-memory bbm log is kept sorted by disk ordinal and then by start
+ * sector, so the bad blocks of one disk form a single run that can be
+ * searched.  The on-disk order carries no meaning; load_bbm_log() sorts
+ * whatever it finds.
+ */
+static unsigned long long bbm_entry_start(const struct bbm_log_entry *entry)
+{
+	return __le48_to_cpu(&entry->defective_block_start);
+}
+
+static int cmp_bbm_entry(const void *a, const void *b)
+{
+	const struct bbm_log_entry *ea = a, *eb = b;
+	unsigned long long sa = bbm_entry_start(ea);
+	unsigned long long sb = bbm_entry_start(eb);
+
+	if (ea->disk_ordinal != eb->disk_ordinal)
+		return ea->disk_ordinal < eb->disk_ordinal ? -1 : 1;
+	if (sa != sb)
+		return sa < sb ? -1 : 1;
+	return 0;
+}
+
+/* position of the first entry at or after (idx, sector) */
+static __u32 bbm_log_find(const struct bbm_log *log, const unsigned int idx,
+			  const unsigned long long sector)
+{
+	__u32 lo = 0, hi = log->entry_count;
+
+	while (lo < hi) {
+		__u32 mid = lo + (hi - lo) / 2;
+		const struct bbm_log_entry *e = &log->marked_block_entries[mid];
+
+		if (e->disk_ordinal < idx ||
+		    (e->disk_ordinal == idx && bbm_entry_start(e) < sector))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void bbm_log_remove(struct bbm_log *log, const __u32 pos, const __u32 n)
+{
+	struct bbm_log_entry *entries = log->marked_block_entries;
+
+	memmove(&entries[pos], &entries[pos + n],
+		(log->entry_count - pos - n) * sizeof(*entries));
+	log->entry_count -= n;
+}
+
+/* caller checks there is room for another entry */
+static void bbm_log_insert(struct bbm_log *log, const __u8 idx,
+			   const unsigned long long sector, const int cnt)
+{
+	struct bbm_log_entry *entries = log->marked_block_entries;
+	__u32 pos = bbm_log_find(log, idx, sector);
+
+	memmove(&entries[pos + 1], &entries[pos],
+		(log->entry_count - pos) * sizeof(*entries));
+	entries[pos].defective_block_start = __cpu_to_le48(sector);
+	entries[pos].marked_count = cnt - 1;
+	entries[pos].disk_ordinal = idx;
+	log->entry_count++;
+}
+
 /* check if bad block is not partially stored in bbm log */
 static int is_stored_in_bbm(struct bbm_log *log, const __u8 idx, const unsigned
 			    long long sector, const int length, __u32 *pos)
 {
-	__u32 i;
+	__u32 i = bbm_log_find(log, idx, sector);
 
-	for (i = *pos; i < log->entry_count; i++) {
+	if (i < *pos)
+		i = *pos;
+
+	for (; i < log->entry_count; i++) {
 		struct bbm_log_entry *entry = &log->marked_block_entries[i];
 		unsigned long long bb_start;
 		unsigned long long bb_end;
 
-		bb_start = __le48_to_cpu(&entry->defective_block_start);
+		bb_start = bbm_entry_start(entry);
 		bb_end = bb_start + (entry->marked_count + 1);
 
-		if ((entry->disk_ordinal == idx) && (bb_start >= sector) &&
-		    (bb_end <= sector + length)) {
+		if ((entry->disk_ordinal != idx) ||
+		    (bb_start >= sector + length))
+			break;
+		if (bb_end <= sector + length) {
 			*pos = i;
 			return 1;
 		}
@@ -1091,7 +1236,7 @@ static int record_new_badblock(struct bbm_log *log, const __u8 idx, unsigned
 		struct bbm_log_entry *e = &log->marked_block_entries[pos];
 
 		if ((e->marked_count + 1 == BBM_LOG_MAX_LBA_ENTRY_VAL) &&
-		    (__le48_to_cpu(&e->defective_block_start) == sector)) {
+		    (bbm_entry_start(e) == sector)) {
 			sector += BBM_LOG_MAX_LBA_ENTRY_VAL;
 			length -= BBM_LOG_MAX_LBA_ENTRY_VAL;
 			pos = pos + 1;
@@ -1104,8 +1249,10 @@ static int record_new_badblock(struct bbm_log *log, const __u8 idx, unsigned
 	if (entry) {
 		int cnt = (length <= BBM_LOG_MAX_LBA_ENTRY_VAL) ? length :
 			BBM_LOG_MAX_LBA_ENTRY_VAL;
-		entry->defective_block_start = __cpu_to_le48(sector);
-		entry->marked_count = cnt - 1;
+
+		/* the entry moves to 'sector', re-insert to keep the order */
+		bbm_log_remove(log, pos, 1);
+		bbm_log_insert(log, idx, sector, cnt);
 		if (cnt == length)
 			return 1;
 		sector += cnt;
@@ -1120,17 +1267,11 @@ static int record_new_badblock(struct bbm_log *log, const __u8 idx, unsigned
 	while (length > 0) {
 		int cnt = (length <= BBM_LOG_MAX_LBA_ENTRY_VAL) ? length :
 			BBM_LOG_MAX_LBA_ENTRY_VAL;
-		struct bbm_log_entry *entry =
-			&log->marked_block_entries[log->entry_count];
 
-		entry->defective_block_start = __cpu_to_le48(sector);
-		entry->marked_count = cnt - 1;
-		entry->disk_ordinal = idx;
+		bbm_log_insert(log, idx, sector, cnt);
 
 		sector += cnt;
 		length -= cnt;
-
-		log->entry_count++;
 	}
 
 	return new_bb;
@@ -1139,38 +1280,27 @@ static int record_new_badblock(struct bbm_log *log, const __u8 idx, unsigned
 /* clear all bad blocks for given disk */
 static void clear_disk_badblocks(struct bbm_log *log, const __u8 idx)
 {
-	__u32 i = 0;
+	__u32 first = bbm_log_find(log, idx, 0);
+	__u32 last = bbm_log_find(log, idx + 1, 0);
 
-	while (i < log->entry_count) {
-		struct bbm_log_entry *entries = log->marked_block_entries;
-
-		if (entries[i].disk_ordinal == idx) {
-			if (i < log->entry_count - 1)
-				entries[i] = entries[log->entry_count - 1];
-			log->entry_count--;
-		} else {
-			i++;
-		}
-	}
+	bbm_log_remove(log, first, last - first);
 }
 
 /* clear given bad block */
 static int clear_badblock(struct bbm_log *log, const __u8 idx, const unsigned
 			  long long sector, const int length) {
-	__u32 i = 0;
+	__u32 i = bbm_log_find(log, idx, sector);
 
-	while (i < log->entry_count) {
-		struct bbm_log_entry *entries = log->marked_block_entries;
+	for (; i < log->entry_count; i++) {
+		struct bbm_log_entry *entry = &log->marked_block_entries[i];
 
-		if ((entries[i].disk_ordinal == idx) &&
-		    (__le48_to_cpu(&entries[i].defective_block_start) ==
-		     sector) && (entries[i].marked_count + 1 == length)) {
-			if (i < log->entry_count - 1)
-				entries[i] = entries[log->entry_count - 1];
-			log->entry_count--;
+		if ((entry->disk_ordinal != idx) ||
+		    (bbm_entry_start(entry) != sector))
+			break;
+		if (entry->marked_count + 1 == length) {
+			bbm_log_remove(log, i, 1);
 			break;
 		}
-		i++;
 	}
 
 	return 1;
@@ -1207,6 +1337,9 @@ static int load_bbm_log(struct intel_super *super)
 			return 4;
 
 		memcpy(super->bbm_log, log, bbm_log_size);
+		qsort(super->bbm_log->marked_block_entries,
+		      super->bbm_log->entry_count,
+		      sizeof(struct bbm_log_entry), cmp_bbm_entry);
 	} else {
 		super->bbm_log->signature = __cpu_to_le32(BBM_LOG_SIGNATURE);
 		super->bbm_log->entry_count = 0;
@@ -1233,7 +1366,7 @@ static int is_bad_block_in_volume(const struct bbm_log_entry *entry,
 	return 0;
 }
 
-/* get list of bad blocks on a drive for a volume */
+/* get list of bad blocks on a drive for a volume, sorted by sector */
 static void get_volume_badblocks(const struct bbm_log *log, const __u8 idx,
 			const unsigned long long start_sector,
 			const unsigned long long size,
@@ -1242,25 +1375,33 @@ static void get_volume_badblocks(const struct bbm_log *log, const __u8 idx,
 	__u32 count = 0;
 	__u32 i;
 
-	for (i = 0; i < log->entry_count; i++) {
+	/* an entry covers at most BBM_LOG_MAX_LBA_ENTRY_VAL sectors, so only
+	 * that far before the volume can an entry still reach into it
+	 */
+	i = bbm_log_find(log, idx, start_sector > BBM_LOG_MAX_LBA_ENTRY_VAL ?
+			 start_sector - BBM_LOG_MAX_LBA_ENTRY_VAL : 0);
+
+	for (; i < log->entry_count; i++) {
 		const struct bbm_log_entry *ent =
 			&log->marked_block_entries[i];
 		struct md_bb_entry *bb;
 
-		if ((ent->disk_ordinal == idx) &&
-		    is_bad_block_in_volume(ent, start_sector, size)) {
-
-			if (!bbs->entries) {
-				bbs->entries = xmalloc(BBM_LOG_MAX_ENTRIES *
-						     sizeof(*bb));
-				if (!bbs->entries)
-					break;
-			}
+		if ((ent->disk_ordinal != idx) ||
+		    (bbm_entry_start(ent) >= start_sector + size))
+			break;
+		if (!is_bad_block_in_volume(ent, start_sector, size))
+			continue;
 
-			bb = &bbs->entries[count++];
-			bb->sector = __le48_to_cpu(&ent->defective_block_start);
-			bb->length = ent->marked_count + 1;
+		if (!bbs->entries) {
+			bbs->entries = xmalloc(BBM_LOG_MAX_ENTRIES *
+					     sizeof(*bb));
+			if (!bbs->entries)
+				break;
 		}
+
+		bb = &bbs->entries[count++];
+		bb->sector = bbm_entry_start(ent);
+		bb->length = ent->marked_count + 1;
 	}
 	bbs->count = count;
 }
@@ -2352,6 +2493,7 @@ static void brief_detail_super_imsm(struct supertype *st, char *subarray)
 
 static int imsm_read_serial(int fd, char *devname, __u8 *serial,
 			    size_t serial_buf_len);
+static void imsm_identify_prefetch(dev_t *devids, int count, enum sys_dev_type hba_type);
 static void fd2devname(int fd, char *name);
 
 void print_encryption_information(int disk_fd, enum sys_dev_type hba_type)
@@ -2550,11 +2692,55 @@ static int ahci_enumerate_ports(struct sys_dev *hba, unsigned long port_count, i
 	return err;
 }
 
+/* Prefetch identification of all NVMe disks attached to @hba */
+static void prefetch_nvme_info(struct sys_dev *hba)
+{
+	struct dirent *ent;
+	dev_t *devids = NULL;
+	int count = 0;
+	int alloc = 0;
+	DIR *dir;
+
+	dir = opendir("/sys/block/");
+	if (!dir)
+		return;
+
+	for (ent = readdir(dir); ent; ent = readdir(dir)) {
+		char cntrl_path[PATH_MAX];
+		struct stat st;
+		int fd = -1;
+
+		if (!strstr(ent->d_name, "nvme"))
+			continue;
+
+		fd = open_dev(ent->d_name);
+		if (!is_fd_valid(fd))
+			continue;
+
+		if (diskfd_to_devpath(fd, 1, cntrl_path) &&
+		    is_path_attached_to_hba(cntrl_path, hba->path) &&
+		    fstat(fd, &st) == 0) {
+			if (count == alloc) {
+				alloc = alloc ? alloc * 2 : 16;
+				devids = xrealloc(devids, alloc * sizeof(*devids));
+			}
+			devids[count++] = st.st_rdev;
+		}
+		close_fd(&fd);
+	}
+	closedir(dir);
+
+	imsm_identify_prefetch(devids, count, hba->type);
+	free(devids);
+}
+
 static int print_nvme_info(struct sys_dev *hba)
 {
 	struct dirent *ent;
 	DIR *dir;
 
+	prefetch_nvme_info(hba);
+
 	dir = opendir("/sys/block/");
 	if (!dir)
 		return 1;
@@ -4067,6 +4253,7 @@ static void free_devlist(struct intel_super *super)
 {
 	struct intel_dev *dv;
 
+	imsm_invalidate_lookup(super);
 	while (super->devlist) {
 		dv = super->devlist->next;
 		free(super->devlist->dev);
@@ -4219,10 +4406,219 @@ mdadm_status_t scsi_get_serial(int fd, void *buf, size_t buf_len)
 }
 
 
+/*
+ * Raw serial numbers are memoized per disk for the process lifetime.
+ * A disk is keyed by device number and disk sequence number, so a dev_t
+ * handed to a newly plugged disk does not return a stale serial.
+ */
+#define IMSM_RAW_SERIAL_LEN 50
+
+struct serial_memo {
+	dev_t devid;
+	unsigned long long seq;
+	char serial[IMSM_RAW_SERIAL_LEN];
+	struct serial_memo *next;
+};
+
+static struct serial_memo *serial_memo;
+
+static void imsm_remember_serial(dev_t devid, unsigned long long seq, char *serial)
+{
+	struct serial_memo *memo;
+
+	for (memo = serial_memo; memo; memo = memo->next)
+		if (memo->devid == devid)
+			break;
+
+	if (!memo) {
+		memo = xmalloc(sizeof(*memo));
+		memo->devid = devid;
+		memo->next = serial_memo;
+		serial_memo = memo;
+	}
+
+	memo->seq = seq;
+	memcpy(memo->serial, serial, IMSM_RAW_SERIAL_LEN);
+}
+
+static int imsm_query_serial(int fd, char *buf)
+{
+	int rv;
+
+	rv = nvme_get_serial(fd, buf, IMSM_RAW_SERIAL_LEN);
+
+	if (rv)
+		rv = scsi_get_serial(fd, buf, IMSM_RAW_SERIAL_LEN);
+
+	return rv;
+}
+
+/* Read raw serial of a disk into @buf (IMSM_RAW_SERIAL_LEN bytes).
+ * Failures are not memoized, they may be transient.
+ */
+static int imsm_get_raw_serial(int fd, char *buf)
+{
+	struct serial_memo *memo;
+	unsigned long long seq;
+	dev_t devid;
+	int rv;
+
+	if (!get_disk_identity(fd, &devid, &seq))
+		return imsm_query_serial(fd, buf);
+
+	for (memo = serial_memo; memo; memo = memo->next) {
+		if (memo->devid == devid && memo->seq == seq) {
+			memcpy(buf, memo->serial, IMSM_RAW_SERIAL_LEN);
+			return 0;
+		}
+	}
+
+	rv = imsm_query_serial(fd, buf);
+	if (rv == 0)
+		imsm_remember_serial(devid, seq, buf);
+
+	return rv;
+}
+
+#define IDENTIFY_MAX_JOBS 32
+
+struct identify_reply {
+	dev_t devid;
+	unsigned long long seq;
+	int serial_rv;
+	char serial[IMSM_RAW_SERIAL_LEN];
+	mdadm_status_t enc_status;
+	encryption_information_t information;
+};
+
+/* Child side of imsm_identify_prefetch(): query one disk and report back */
+static void imsm_identify_child(dev_t devid, enum sys_dev_type hba_type, int out)
+{
+	struct identify_reply reply;
+	char nm[32];
+	int fd;
+
+	memset(&reply, 0, sizeof(reply));
+	reply.enc_status = MDADM_STATUS_ERROR;
+
+	snprintf(nm, sizeof(nm), "%d:%d", major(devid), minor(devid));
+	fd = dev_open(nm, O_RDONLY);
+	if (!is_fd_valid(fd))
+		_exit(1);
+	if (!get_disk_identity(fd, &reply.devid, &reply.seq))
+		_exit(1);
+
+	reply.serial_rv = imsm_query_serial(fd, reply.serial);
+
+	switch (hba_type) {
+	case SYS_DEV_VMD:
+	case SYS_DEV_NVME:
+		reply.enc_status = get_nvme_opal_encryption_information(fd, &reply.information, 0);
+		break;
+	case SYS_DEV_SATA:
+	case SYS_DEV_SATA_VMD:
+		reply.enc_status = get_ata_encryption_information(fd, &reply.information, 0);
+		break;
+	default:
+		break;
+	}
+
+	if (write(out, &reply, sizeof(reply)) != sizeof(reply))
+		_exit(1);
+	_exit(0);
+}
+
+/* Collect the reply of a prefetch child and seed the memos with it */
+static void imsm_identify_collect(int in, pid_t pid, enum sys_dev_type hba_type)
+{
+	struct identify_reply reply;
+	size_t got = 0;
+	ssize_t n;
+
+	while (got < sizeof(reply)) {
+		n = read(in, (char *)&reply + got, sizeof(reply) - got);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		got += n;
+	}
+	close(in);
+	while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+		;
+
+	if (got != sizeof(reply))
+		return;
+
+	if (reply.serial_rv == 0)
+		imsm_remember_serial(reply.devid, reply.seq, reply.serial);
+
+	if (reply.enc_status == MDADM_STATUS_SUCCESS)
+		encryption_information_remember(reply.devid, reply.seq,
+						hba_type == SYS_DEV_VMD ||
+						hba_type == SYS_DEV_NVME,
+						&reply.information);
+}
+
+/*
+ * Identification queries (SCSI INQUIRY, NVMe/ATA security commands) block
+ * for the duration of a device round trip.  When a whole set of disks is
+ * about to be identified, issue the queries from forked children, at most
+ * IDENTIFY_MAX_JOBS at a time, and seed the memos with the replies so the
+ * serial callers that follow are answered without touching the devices.
+ * Encryption information is fetched as well unless @hba_type is
+ * SYS_DEV_UNKNOWN.  Anything that fails here is simply queried again
+ * in-process later.
+ */
+static void imsm_identify_prefetch(dev_t *devids, int count, enum sys_dev_type hba_type)
+{
+	int fds[IDENTIFY_MAX_JOBS];
+	pid_t pids[IDENTIFY_MAX_JOBS];
+	int started = 0;
+	int done = 0;
+
+	if (count < 2 || check_env("IMSM_DEVNAME_AS_SERIAL"))
+		return;
+
+	fflush(stdout);
+	fflush(stderr);
+
+	while (done < count) {
+		while (started < count && started - done < IDENTIFY_MAX_JOBS) {
+			int slot = started % IDENTIFY_MAX_JOBS;
+			int pfd[2];
+
+			fds[slot] = -1;
+			started++;
+
+			if (pipe(pfd) != 0)
+				continue;
+
+			pids[slot] = fork();
+			if (pids[slot] == 0) {
+				close(pfd[0]);
+				imsm_identify_child(devids[started - 1], hba_type, pfd[1]);
+			}
+			close(pfd[1]);
+			if (pids[slot] < 0) {
+				close(pfd[0]);
+				continue;
+			}
+			fds[slot] = pfd[0];
+		}
+
+		if (is_fd_valid(fds[done % IDENTIFY_MAX_JOBS]))
+			imsm_identify_collect(fds[done % IDENTIFY_MAX_JOBS],
+					      pids[done % IDENTIFY_MAX_JOBS], hba_type);
+		done++;
+	}
+}
+
+
 static int imsm_read_serial(int fd, char *devname,
 			    __u8 *serial, size_t serial_buf_len)
 {
-	char buf[50];
+	char buf[IMSM_RAW_SERIAL_LEN];
 	int rv;
 	size_t len;
 	char *dest;
@@ -4237,10 +4633,7 @@ static int imsm_read_serial(int fd, char *devname,
 		return 0;
 	}
 
-	rv = nvme_get_serial(fd, buf, sizeof(buf));
-
-	if (rv)
-		rv = scsi_get_serial(fd, buf, sizeof(buf));
+	rv = imsm_get_raw_serial(fd, buf);
 
 	if (rv != 0) {
 		if (devname)
@@ -4289,14 +4682,82 @@ static void serialcpy(__u8 *dest, __u8 *src)
 	strncpy((char *) dest, (char *) src, MAX_RAID_SERIAL_LEN);
 }
 
+static unsigned int imsm_serial_hash(__u8 *serial)
+{
+	unsigned int h = 2166136261u;
+	int i;
+
+	for (i = 0; i < MAX_RAID_SERIAL_LEN && serial[i]; i++)
+		h = (h ^ serial[i]) * 16777619u;
+
+	return h & (IMSM_SERIAL_HASH_SIZE - 1);
+}
+
+/* index devlist and disks, keeping the first entry of each key in list
+ * order so that lookups return what a list walk would
+ */
+static void imsm_rebuild_lookup(struct intel_super *super)
+{
+	struct imsm_lookup *lk = &super->lookup;
+	struct intel_dev *dv;
+	struct dl *dl;
+
+	lk->valid = 0;
+	memset(lk->dev, 0, sizeof(lk->dev));
+	memset(lk->disk, 0, sizeof(lk->disk));
+	memset(lk->serial, 0, sizeof(lk->serial));
+
+	for (dv = super->devlist; dv; dv = dv->next)
+		if (dv->index < ARRAY_SIZE(lk->dev) && !lk->dev[dv->index])
+			lk->dev[dv->index] = dv;
+
+	for (dl = super->disks; dl; dl = dl->next) {
+		unsigned int h = imsm_serial_hash(dl->serial);
+		unsigned int n;
+
+		if (dl->index >= 0 && dl->index < IMSM_MAX_DEVICES &&
+		    !lk->disk[dl->index])
+			lk->disk[dl->index] = dl;
+
+		/* linear probing, a full table only costs list walks */
+		for (n = 0; n < IMSM_SERIAL_HASH_SIZE; n++) {
+			struct dl **slot = &lk->serial[(h + n) &
+						       (IMSM_SERIAL_HASH_SIZE - 1)];
+
+			if (!*slot)
+				*slot = dl;
+			if (*slot == dl ||
+			    serialcmp((*slot)->serial, dl->serial) == 0)
+				break;
+		}
+	}
+	lk->valid = 1;
+}
+
 static struct dl *serial_to_dl(__u8 *serial, struct intel_super *super)
 {
 	struct dl *dl;
 
+	if (super->lookup.valid) {
+		unsigned int h = imsm_serial_hash(serial);
+		unsigned int n;
+
+		for (n = 0; n < IMSM_SERIAL_HASH_SIZE; n++) {
+			dl = super->lookup.serial[(h + n) &
+						  (IMSM_SERIAL_HASH_SIZE - 1)];
+			if (!dl)
+				break;
+			if (serialcmp(dl->serial, serial) == 0)
+				return dl;
+		}
+	}
+
 	for (dl = super->disks; dl; dl = dl->next)
 		if (serialcmp(dl->serial, serial) == 0)
 			break;
 
+	if (dl)
+		super->lookup.valid = 0;
 	return dl;
 }
 
@@ -4715,6 +5176,7 @@ load_and_parse_mpb(int fd, struct intel_super *super, char *devname, int keep_fd
 	err = parse_raid_devices(super);
 	if (err)
 		return err;
+	imsm_rebuild_lookup(super);
 	err = load_bbm_log(super);
 	clear_hi(super);
 	return err;
@@ -4736,6 +5198,7 @@ static void free_imsm_disks(struct intel_super *super)
 {
 	struct dl *d;
 
+	imsm_invalidate_lookup(super);
 	while (super->disks) {
 		d = super->disks;
 		super->disks = d->next;
@@ -5203,7 +5666,9 @@ imsm_thunderdome(struct intel_super **super_list, int len)
 		dl->next = champion->disks;
 		champion->disks = dl;
 		s->disks = NULL;
+		imsm_invalidate_lookup(s);
 	}
+	imsm_rebuild_lookup(champion);
 
 	/* delete 'champion' from super_list */
 	for (del = super_list; *del; ) {
@@ -5317,9 +5782,23 @@ get_devlist_super_block(struct md_list *devlist, struct intel_super **super_list
 			int *max, int keep_fd)
 {
 	struct md_list *tmpdev;
+	dev_t *devids = NULL;
+	int count = 0;
 	int err = 0;
 	int i = 0;
 
+	for (tmpdev = devlist; tmpdev; tmpdev = tmpdev->next)
+		if (tmpdev->used == 1 && tmpdev->container != 1)
+			count++;
+	if (count) {
+		devids = xcalloc(count, sizeof(*devids));
+		for (i = 0, tmpdev = devlist; tmpdev; tmpdev = tmpdev->next)
+			if (tmpdev->used == 1 && tmpdev->container != 1)
+				devids[i++] = tmpdev->st_rdev;
+		imsm_identify_prefetch(devids, count, SYS_DEV_UNKNOWN);
+		free(devids);
+	}
+
 	for (i = 0, tmpdev = devlist; tmpdev; tmpdev = tmpdev->next) {
 		if (tmpdev->used != 1)
 			continue;
@@ -5431,6 +5910,17 @@ get_sra_super_block(int fd, struct intel_super **super_list, char *devname, int
 		err = 1;
 		goto error;
 	}
+	for (sd = sra->devs; sd; sd = sd->next)
+		i++;
+	if (i) {
+		dev_t *devids = xcalloc(i, sizeof(*devids));
+
+		for (sd = sra->devs, i = 0; sd; sd = sd->next, i++)
+			devids[i] = makedev(sd->disk.major, sd->disk.minor);
+		imsm_identify_prefetch(devids, i, SYS_DEV_UNKNOWN);
+		free(devids);
+	}
+
 	/* load all mpbs */
 	devnm = fd2devnm(fd);
 	for (sd = sra->devs, i = 0; sd; sd = sd->next, i++) {
@@ -6168,6 +6658,7 @@ static int add_to_super_imsm(struct supertype *st, mdu_disk_info_t *dk,
 		 */
 		dd->next = super->disks;
 		super->disks = dd;
+		imsm_invalidate_lookup(super);
 		write_super_imsm_spare(super, dd);
 	}
 
@@ -6215,6 +6706,7 @@ static union {
 static int write_super_imsm_spare(struct intel_super *super, struct dl *d)
 {
 	struct imsm_super *spare = &spare_record.anchor;
+	__u32 family;
 	__u32 sum;
 
 	if (d->index != -1)
@@ -6236,9 +6728,11 @@ static int write_super_imsm_spare(struct intel_super *super, struct dl *d)
 		convert_to_4k_imsm_disk(&spare->disk[0]);
 
 	sum = __gen_imsm_checksum(spare);
-	spare->family_num = __cpu_to_le32(sum);
+	family = __cpu_to_le32(sum);
+	sum = imsm_checksum_delta(sum, spare->family_num, family);
+	sum = imsm_checksum_delta(sum, spare->orig_family_num, 0);
+	spare->family_num = family;
 	spare->orig_family_num = 0;
-	sum = __gen_imsm_checksum(spare);
 	spare->check_sum = __cpu_to_le32(sum);
 
 	if (store_imsm_mpb(d->fd, spare)) {
@@ -7960,6 +8454,7 @@ static int kill_subarray_imsm(struct supertype *st, char *subarray_id)
 		return 0;
 	}
 
+	imsm_invalidate_lookup(super);
 	for (dp = &super->devlist; *dp;)
 		if ((*dp)->index == current_vol) {
 			*dp = (*dp)->next;
@@ -9487,6 +9982,7 @@ static int remove_disk_super(struct intel_super *super, int major, int minor)
 			else
 				super->disks = dl->next;
 			dl->next = NULL;
+			imsm_invalidate_lookup(super);
 			__free_imsm_disk(dl, 1);
 			dprintf("removed %x:%x\n", major, minor);
 			break;
@@ -9514,6 +10010,7 @@ static int add_remove_disk_update(struct intel_super *super)
 		if (disk_cfg->action == DISK_ADD) {
 			disk_cfg->next = super->disks;
 			super->disks = disk_cfg;
+			imsm_invalidate_lookup(super);
 			check_degraded = 1;
 			dprintf("added %x:%x\n",
 				disk_cfg->major, disk_cfg->minor);
@@ -10313,6 +10810,7 @@ static void imsm_process_update(struct supertype *st,
 			break;
 		}
 
+		imsm_invalidate_lookup(super);
 		for (dp = &super->devlist; *dp;)
 			if ((*dp)->index == (unsigned)super->current_vol) {
 				*dp = (*dp)->next;
@@ -10382,6 +10880,7 @@ static void imsm_process_update(struct supertype *st,
 	default:
 		pr_err("error: unsupported process update type:(type: %d)\n",	type);
 	}
+	imsm_rebuild_lookup(super);
 }
 
 static struct mdinfo *get_spares_for_grow(struct supertype *st);
@@ -10670,6 +11169,7 @@ static void imsm_delete(struct intel_super *super, struct dl **dlp, unsigned ind
 	struct bbm_log *log = super->bbm_log;
 
 	dprintf("deleting device[%d] from imsm_super\n", index);
+	imsm_invalidate_lookup(super);
 
 	/* shift all indexes down one */
 	for (iter = super->disks; iter; iter = iter->next)
@@ -12515,6 +13015,61 @@ int check_degradation_change(struct mdinfo *info,
 	return new_degraded;
 }
 
+/* phases of one imsm_manage_reshape() step, timed for IMSM_RESHAPE_STATS */
+enum reshape_phase {
+	RESHAPE_READ,		/* save_stripes() of a critical unit */
+	RESHAPE_BACKUP,		/* write to the migration copy area */
+	RESHAPE_CHECKPOINT,	/* migration record updates */
+	RESHAPE_WAIT,		/* kernel reshaping the step */
+	RESHAPE_PHASES
+};
+
+static const char * const reshape_phase_names[RESHAPE_PHASES] = {
+	"read", "backup", "checkpoint", "reshape"
+};
+
+struct reshape_stats {
+	int enabled;
+	unsigned long long steps;
+	unsigned long long critical;	/* steps that went through copy area */
+	unsigned long long blocks;
+	unsigned long long usec[RESHAPE_PHASES];
+	struct timespec mark;
+};
+
+static void reshape_stats_mark(struct reshape_stats *rs)
+{
+	if (rs->enabled)
+		clock_gettime(CLOCK_MONOTONIC, &rs->mark);
+}
+
+/* charge the time since the last mark to @phase and start a new mark */
+static void reshape_stats_add(struct reshape_stats *rs, enum reshape_phase phase)
+{
+	struct timespec now;
+
+	if (!rs->enabled)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	rs->usec[phase] += (now.tv_sec - rs->mark.tv_sec) * 1000000LL +
+		(now.tv_nsec - rs->mark.tv_nsec) / 1000;
+	rs->mark = now;
+}
+
+static void reshape_stats_report(struct reshape_stats *rs)
+{
+	int i;
+
+	if (!rs->enabled || !rs->steps)
+		return;
+	pr_info("imsm reshape: %llu steps (%llu through copy area), %llu blocks\n",
+		rs->steps, rs->critical, rs->blocks);
+	for (i = 0; i < RESHAPE_PHASES; i++)
+		pr_info("imsm reshape: %-10s %10llu ms total, %8llu us per step\n",
+			reshape_phase_names[i], rs->usec[i] / 1000,
+			rs->usec[i] / rs->steps);
+}
+
 /*******************************************************************************
  * Function:	imsm_manage_reshape
  * Description:	Function finds array under reshape and it manages reshape
@@ -12562,10 +13117,13 @@ static int imsm_manage_reshape(
 	int degraded = 0;
 	int source_layout = 0;
 	int subarray_index = -1;
+	struct reshape_stats stats = {0};
 
 	if (!sra)
 		return ret_val;
 
+	stats.enabled = check_env("IMSM_RESHAPE_STATS");
+
 	if (!fds || !offsets)
 		goto abort;
 
@@ -12642,6 +13200,8 @@ static int imsm_manage_reshape(
 			* current_migr_unit(migr_rec);
 		unsigned long long border;
 
+		reshape_stats_mark(&stats);
+
 		/* Check that array hasn't become failed.
 		 */
 		degraded = check_degradation_change(sra, fds, degraded);
@@ -12693,6 +13253,7 @@ static int imsm_manage_reshape(
 				dprintf("imsm: Cannot save stripes to buffer\n");
 				goto abort;
 			}
+			reshape_stats_add(&stats, RESHAPE_READ);
 			/* Convert data to destination format and store it
 			 * in backup general migration area
 			 */
@@ -12701,14 +13262,23 @@ static int imsm_manage_reshape(
 				dprintf("imsm: Cannot save stripes to target devices\n");
 				goto abort;
 			}
+			reshape_stats_add(&stats, RESHAPE_BACKUP);
 			if (save_checkpoint_imsm(st, sra,
 						 UNIT_SRC_IN_CP_AREA)) {
 				dprintf("imsm: Cannot write checkpoint to migration record (UNIT_SRC_IN_CP_AREA)\n");
 				goto abort;
 			}
+			reshape_stats_add(&stats, RESHAPE_CHECKPOINT);
+			stats.critical++;
 		} else {
-			/* set next step to use whole border area */
-			border /= next_step;
+			/* set next step to use whole border area.
+			 * 'border' is per member disk, a step of array
+			 * blocks writes next_step / ndata of it, so the
+			 * source of the whole step stays intact until the
+			 * step is checkpointed as long as
+			 * next_step <= border * ndata.
+			 */
+			border = border * ndata / next_step;
 			if (border > 1)
 				next_step *= border;
 		}
@@ -12721,6 +13291,7 @@ static int imsm_manage_reshape(
 			next_step = max_position;
 		sysfs_set_num(sra, NULL, "suspend_lo", sra->reshape_progress);
 		sysfs_set_num(sra, NULL, "suspend_hi", next_step);
+		stats.blocks += next_step - sra->reshape_progress;
 		sra->reshape_progress = next_step;
 
 		/* wait until reshape finish */
@@ -12728,6 +13299,7 @@ static int imsm_manage_reshape(
 			dprintf("wait_for_reshape_imsm returned error!\n");
 			goto abort;
 		}
+		reshape_stats_add(&stats, RESHAPE_WAIT);
 
 		if (save_checkpoint_imsm(st, sra, UNIT_SRC_NORMAL) == 1) {
 			/* ignore error == 2, this can mean end of reshape here
@@ -12735,6 +13307,8 @@ static int imsm_manage_reshape(
 			dprintf("imsm: Cannot write checkpoint to migration record (UNIT_SRC_NORMAL)\n");
 			goto abort;
 		}
+		reshape_stats_add(&stats, RESHAPE_CHECKPOINT);
+		stats.steps++;
 
 		if (sigterm)
 			goto abort;
@@ -12771,6 +13345,7 @@ static int imsm_manage_reshape(
 	imsm_fix_size_mismatch(st, subarray_index);
 
 abort:
+	reshape_stats_report(&stats);
 	free(buf);
 	/* See Grow.c: abort_reshape() for further explanation */
 	sysfs_set_num(sra, NULL, "suspend_lo", 0x7FFFFFFFFFFFFFFFULL);
@@ -13017,14 +13592,51 @@ static int locate_bitmap_imsm(struct supertype *st, int fd, int node_num)
 {
 	struct intel_super *super = st->sb;
 	unsigned long long offset;
-	int vol_idx = super->current_vol;
+	struct intel_dev *dv;
+	int vol_idx;
+	int mustfree = 0;
+
+	if (!super) {
+		if (st->ss->load_super(st, fd, NULL))
+			return -1;
+		super = st->sb;
+		mustfree = 1;
+	}
 
-	if (!super->devlist || vol_idx == -1)
+	vol_idx = super->current_vol;
+	if (vol_idx == -1 && st->subarray[0]) {
+		char *ep;
+
+		vol_idx = strtoul(st->subarray, &ep, 10);
+		if (*ep || vol_idx >= super->anchor->num_raid_devs ||
+		    get_imsm_dev(super, vol_idx)->rwh_policy != RWH_BITMAP)
+			vol_idx = -1;
+	} else if (vol_idx == -1) {
+		/* Nothing selected: only a lone bitmap volume is unambiguous */
+		for (dv = super->devlist; dv; dv = dv->next) {
+			if (dv->dev->rwh_policy != RWH_BITMAP)
+				continue;
+			if (vol_idx != -1) {
+				pr_err("more than one volume has a bitmap\n");
+				vol_idx = -1;
+				break;
+			}
+			vol_idx = dv->index;
+		}
+	}
+
+	if (!super->devlist || vol_idx == -1) {
+		if (mustfree)
+			free_super_imsm(st);
 		return -1;
+	}
 
-	offset = get_bitmap_header_sector(super, super->current_vol);
+	offset = get_bitmap_header_sector(super, vol_idx);
 	dprintf("bitmap header offset is %llu\n", offset);
 
+	if (mustfree)
+		free_super_imsm(st);
+
 	lseek64(fd, offset << 9, 0);
 
 	return 0;
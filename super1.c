@@ -316,6 +316,36 @@ static int awrite(struct align_fd *afd, void *buf, int len)
 	return len;
 }
 
+/*
+ * Copy 'len' bytes from the current offset of afrom to the current
+ * offset of ato.  Whole 4K blocks can be moved with plain read/write
+ * in large pieces as that is aligned for any sector size we support;
+ * only a trailing partial block needs aread/awrite.
+ * 'buf' must be 4K aligned and 'bufsize' a multiple of 4K.
+ */
+static int acopy(struct align_fd *afrom, struct align_fd *ato,
+		 void *buf, int bufsize, int len)
+{
+	while (len >= 4096) {
+		int n = len & ~4095;
+
+		if (n > bufsize)
+			n = bufsize;
+		if (read(afrom->fd, buf, n) != n)
+			return -1;
+		if (write(ato->fd, buf, n) != n)
+			return -1;
+		len -= n;
+	}
+	if (len) {
+		if (aread(afrom, buf, len) != len)
+			return -1;
+		if (awrite(ato, buf, len) != len)
+			return -1;
+	}
+	return 0;
+}
+
 static inline unsigned int md_feature_any_ppl_on(__u32 feature_map)
 {
 	return ((__cpu_to_le32(feature_map) &
@@ -721,9 +751,10 @@ static int copy_metadata1(struct supertype *st, int from, int to)
 	void *buf;
 	unsigned long long dsize, sb_offset;
 	const int bufsize = 4*1024;
+	const int copysize = 1024*1024;
 	struct mdp_superblock_1 super, *sb;
 
-	if (posix_memalign(&buf, 4096, bufsize) != 0)
+	if (posix_memalign(&buf, 4096, copysize) != 0)
 		return 1;
 
 	if (!get_dev_size(from, NULL, &dsize))
@@ -783,25 +814,18 @@ static int copy_metadata1(struct supertype *st, int from, int to)
 		if (lseek64(to, bitmap_offset<<9, 0) < 0)
 			goto err;
 
-		for (written = 0; written < bytes ; ) {
-			int n = bytes - written;
-			if (n > 4096)
-				n = 4096;
-			if (aread(&afrom, buf, n) != n)
-				goto err;
-			if (written == 0) {
-				/* have the header, can calculate
-				 * correct bitmap bytes */
-				bitmap_super_t *bms;
-				bms = (void *)buf;
-				bytes = calc_bitmap_size(bms, 512);
-				if (n > bytes)
-					n =  bytes;
-			}
-			if (awrite(&ato, buf, n) != n)
-				goto err;
-			written += n;
-		}
+		/* read the header first, then we can calculate
+		 * correct bitmap bytes */
+		if (aread(&afrom, buf, 4096) != 4096)
+			goto err;
+		bytes = calc_bitmap_size((bitmap_super_t *)buf, 512);
+		written = bytes < 4096 ? bytes : 4096;
+		if (awrite(&ato, buf, written) != written)
+			goto err;
+		if (lseek64(from, (bitmap_offset<<9) + written, 0) < 0)
+			goto err;
+		if (acopy(&afrom, &ato, buf, copysize, bytes - written) != 0)
+			goto err;
 	}
 
 	if (super.bblog_size != 0 &&
@@ -811,7 +835,6 @@ static int copy_metadata1(struct supertype *st, int from, int to)
 		/* There is a bad block log */
 		unsigned long long bb_offset = sb_offset;
 		int bytes = __le16_to_cpu(super.bblog_size) * 512;
-		int written = 0;
 		struct align_fd afrom, ato;
 
 		init_afd(&afrom, from);
@@ -824,17 +847,8 @@ static int copy_metadata1(struct supertype *st, int from, int to)
 		if (lseek64(to, bb_offset<<9, 0) < 0)
 			goto err;
 
-		for (written = 0; written < bytes ; ) {
-			int n = bytes - written;
-			if (n > 4096)
-				n = 4096;
-			if (aread(&afrom, buf, n) != n)
-				goto err;
-
-			if (awrite(&ato, buf, n) != n)
-				goto err;
-			written += n;
-		}
+		if (acopy(&afrom, &ato, buf, copysize, bytes) != 0)
+			goto err;
 	}
 
 	free(buf);
@@ -2683,8 +2697,10 @@ static int locate_bitmap1(struct supertype *st, int fd, int node_num)
 		bm_sectors_per_node = calc_bitmap_size(bms, 4096) >> 9;
 		offset += bm_sectors_per_node * node_num;
 	}
-	if (mustfree)
+	if (mustfree) {
 		free(sb);
+		st->sb = NULL;
+	}
 	if (lseek64(fd, offset<<9, 0) < 0) {
 		pr_err("lseek fails\n");
 		ret = -1;
@@ -32,8 +32,17 @@
 
 #define MAX_SYSFS_PATH_LEN	120
 
+#define SYSFS_RULES_HASH	64
+
+/*
+ * SYSFS lines from config are indexed by uuid, or by name when no uuid
+ * is given, as they are parsed.  Rules are applied in reverse config
+ * order, @seq records that order across both indexes.
+ */
 struct dev_sysfs_rule {
 	struct dev_sysfs_rule *next;
+	struct dev_sysfs_rule *hash_next;
+	unsigned int seq;
 	char *devname;
 	int uuid[4];
 	int uuid_set;
@@ -41,6 +50,8 @@ struct dev_sysfs_rule {
 		struct sysfs_entry *next;
 		char *name;
 		char *value;
+		/* name has more than one component, may resolve through symlinks */
+		bool nested;
 	} *entry;
 };
 
@@ -104,6 +115,9 @@ mdadm_status_t write_attr(const char *value, const int fd)
 	return sysfs_write_descriptor(fd, value, strlen(value), NULL);
 }
 
+/* Bumped on every write, as it may change the state of an array */
+unsigned int sysfs_write_generation;
+
 /**
  * sysfs_write_descriptor()- wrapper for write(), projected to be used with sysfs.
  * @fd: file descriptor.
@@ -121,6 +135,7 @@ mdadm_status_t sysfs_write_descriptor(const int fd, const char *value, const ssi
 {
 	ssize_t ret;
 
+	sysfs_write_generation++;
 	ret = write(fd, value, len);
 	if (ret == -1) {
 		if (errno_p)
@@ -1088,8 +1103,8 @@ int sysfs_wait(int fd, int *msec)
 	return n;
 }
 
-int sysfs_rules_apply_check(const struct mdinfo *sra,
-			    const struct sysfs_entry *ent)
+static int sysfs_rules_apply_check(const struct mdinfo *sra,
+				   const struct sysfs_entry *ent)
 {
 	/* Check whether parameter is regular file,
 	 * exists and is under specified directory.
@@ -1125,33 +1140,117 @@ int sysfs_rules_apply_check(const struct mdinfo *sra,
 }
 
 static struct dev_sysfs_rule *sysfs_rules;
+static struct dev_sysfs_rule *sysfs_rules_by_uuid[SYSFS_RULES_HASH];
+static struct dev_sysfs_rule *sysfs_rules_by_name[SYSFS_RULES_HASH];
+static unsigned int sysfs_rules_seq;
+
+static unsigned int sysfs_rules_hash_uuid(const int uuid[4])
+{
+	return (unsigned int)(uuid[0] ^ uuid[1] ^ uuid[2] ^ uuid[3]) % SYSFS_RULES_HASH;
+}
+
+static unsigned int sysfs_rules_hash_name(const char *name)
+{
+	unsigned int h = 5381;
+
+	while (*name)
+		h = h * 33 + (unsigned char)*name++;
+	return h % SYSFS_RULES_HASH;
+}
+
+static struct dev_sysfs_rule *sysfs_rules_next_uuid(struct dev_sysfs_rule *rule,
+						    const int uuid[4])
+{
+	for (; rule; rule = rule->hash_next)
+		if (memcmp(rule->uuid, uuid, sizeof(int[4])) == 0)
+			return rule;
+	return NULL;
+}
+
+static struct dev_sysfs_rule *sysfs_rules_next_name(struct dev_sysfs_rule *rule,
+						    const char *devnm)
+{
+	for (; rule; rule = rule->hash_next)
+		if (strcmp(rule->devname, devnm) == 0)
+			return rule;
+	return NULL;
+}
+
+/* Write one attribute relative to the md directory of the array.
+ * Returns 0 or an errno value describing the failure.
+ */
+static int sysfs_rule_write(int dfd, struct mdinfo *sra, struct sysfs_entry *ent)
+{
+	int err = 0;
+	int fd;
+
+	if (!ent->nested) {
+		/* A plain md/ attribute, refuse to follow the rdN links */
+		fd = openat(dfd, ent->name, O_WRONLY | O_NOFOLLOW | O_CLOEXEC);
+	} else {
+		if (sysfs_rules_apply_check(sra, ent) < 0)
+			return EINVAL;
+		fd = openat(dfd, ent->name, O_WRONLY | O_CLOEXEC);
+	}
+	if (fd < 0)
+		return errno;
+
+	if (sysfs_write_descriptor(fd, ent->value, strlen(ent->value), &err))
+		err = err ? err : EIO;
+
+	close(fd);
+	return err;
+}
 
 void sysfs_rules_apply(char *devnm, struct mdinfo *dev)
 {
-	struct dev_sysfs_rule *rules = sysfs_rules;
+	struct dev_sysfs_rule *by_uuid = NULL;
+	struct dev_sysfs_rule *by_name = NULL;
+	char dname[MAX_SYSFS_PATH_LEN];
+	int dfd = -1;
+	int err = 0;
+
+	if (!dev)
+		return;
+
+	by_uuid = sysfs_rules_next_uuid(sysfs_rules_by_uuid[sysfs_rules_hash_uuid(dev->uuid)],
+					dev->uuid);
+	if (devnm)
+		by_name = sysfs_rules_next_name(sysfs_rules_by_name[sysfs_rules_hash_name(devnm)],
+						devnm);
+	if (!by_uuid && !by_name)
+		return;
+
+	snprintf(dname, MAX_SYSFS_PATH_LEN, "/sys/block/%s/md", dev->sys_name);
+	dfd = open(dname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (!is_fd_valid(dfd))
+		err = errno;
 
-	while (rules) {
-		struct sysfs_entry *ent = rules->entry;
-		int match  = 0;
+	/* Both chains are in descending @seq order, merge them to keep
+	 * the documented application order.
+	 */
+	while (by_uuid || by_name) {
+		struct dev_sysfs_rule *rule;
+		struct sysfs_entry *ent;
 
-		if (!rules->uuid_set) {
-			if (rules->devname)
-				match = strcmp(devnm, rules->devname) == 0;
+		if (!by_name || (by_uuid && by_uuid->seq > by_name->seq)) {
+			rule = by_uuid;
+			by_uuid = sysfs_rules_next_uuid(rule->hash_next, dev->uuid);
 		} else {
-			match = memcmp(dev->uuid, rules->uuid,
-				       sizeof(int[4])) == 0;
+			rule = by_name;
+			by_name = sysfs_rules_next_name(rule->hash_next, devnm);
 		}
 
-		while (match && ent) {
-			if (sysfs_rules_apply_check(dev, ent) < 0)
-				pr_err("SYSFS: failed to write '%s' to '%s'\n",
-					ent->value, ent->name);
-			else
-				sysfs_set_str(dev, NULL, ent->name, ent->value);
-			ent = ent->next;
+		for (ent = rule->entry; ent; ent = ent->next) {
+			int rv = is_fd_valid(dfd) ? sysfs_rule_write(dfd, dev, ent) : err;
+
+			if (rv)
+				pr_err("SYSFS: failed to write '%s' to '%s': %s\n",
+				       ent->value, ent->name, strerror(rv));
 		}
-		rules = rules->next;
 	}
+
+	close_fd(&dfd);
 }
 
 static void sysfs_rule_free(struct dev_sysfs_rule *rule)
@@ -1214,6 +1313,7 @@ void sysfsline(char *line)
 			}
 		} else {
 			struct sysfs_entry *prop;
+			char *name;
 
 			char *sep = strchr(w, '=');
 
@@ -1222,10 +1322,20 @@ void sysfsline(char *line)
 				continue;
 			}
 
+			/* names are relative to the md/ directory */
+			name = w;
+			while (*name == '/')
+				name++;
+			if (name == sep) {
+				pr_err("Cannot parse \"%s\" - ignoring.\n", w);
+				continue;
+			}
+
 			prop = xmalloc(sizeof(*prop));
 			prop->value = xstrdup(sep + 1);
 			*sep = 0;
-			prop->name = xstrdup(w);
+			prop->name = xstrdup(name);
+			prop->nested = strchr(prop->name, '/') != NULL;
 			prop->next = sr->entry;
 			sr->entry = prop;
 		}
@@ -1237,6 +1347,19 @@ void sysfsline(char *line)
 		return;
 	}
 
+	sr->seq = ++sysfs_rules_seq;
+	if (sr->uuid_set) {
+		unsigned int h = sysfs_rules_hash_uuid(sr->uuid);
+
+		sr->hash_next = sysfs_rules_by_uuid[h];
+		sysfs_rules_by_uuid[h] = sr;
+	} else {
+		unsigned int h = sysfs_rules_hash_name(sr->devname);
+
+		sr->hash_next = sysfs_rules_by_name[h];
+		sysfs_rules_by_name[h] = sr;
+	}
+
 	sr->next = sysfs_rules;
 	sysfs_rules = sr;
 }
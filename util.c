@@ -296,6 +296,7 @@ int md_get_array_info(int fd, struct mdu_array_info_s *array)
  */
 int md_set_array_info(int fd, struct mdu_array_info_s *array)
 {
+	mdstat_invalidate();
 	return ioctl(fd, SET_ARRAY_INFO, array);
 }
 
@@ -1346,6 +1347,26 @@ int get_dev_sector_size(int fd, char *dname, unsigned int *sectsizep)
 	return 1;
 }
 
+/* Return the device number and the kernel's disk sequence number of a
+ * block device.  Unlike the device number, the sequence number is never
+ * reused, so the pair tells a replugged disk apart from the one that
+ * previously owned the dev_t.
+ */
+int get_disk_identity(int fd, dev_t *devidp, unsigned long long *seqp)
+{
+	struct stat st;
+	__u64 seq;
+
+	if (fstat(fd, &st) != 0 || !S_ISBLK(st.st_mode))
+		return 0;
+	if (ioctl(fd, BLKGETDISKSEQ, &seq) != 0)
+		return 0;
+
+	*devidp = st.st_rdev;
+	*seqp = seq;
+	return 1;
+}
+
 /* Return true if this can only be a container, not a member device.
  * i.e. is and md device and size is zero
  */
@@ -1769,8 +1790,10 @@ int add_disk(int mdfd, struct supertype *st,
 				sra->devs = sd2;
 			}
 		}
-	} else
+	} else {
+		mdstat_invalidate();
 		rv = ioctl(mdfd, ADD_NEW_DISK, &info->disk);
+	}
 	return rv;
 }
 
@@ -1782,9 +1805,11 @@ int remove_disk(int mdfd, struct supertype *st,
 	/* Remove the disk given by 'info' from the array */
 	if (st->ss->external)
 		rv = sysfs_set_str(sra, info, "slot", STR_COMMON_NONE);
-	else
+	else {
+		mdstat_invalidate();
 		rv = ioctl(mdfd, HOT_REMOVE_DISK, makedev(info->disk.major,
 							  info->disk.minor));
+	}
 	return rv;
 }
 
@@ -1798,6 +1823,7 @@ int hot_remove_disk(int mdfd, unsigned long dev, int force)
 	 * In this case, it can be helpful to wait a little while,
 	 * up to 5 seconds if 'force' is set, or 50 msec if not.
 	 */
+	mdstat_invalidate();
 	while ((ret = ioctl(mdfd, HOT_REMOVE_DISK, dev)) == -1 &&
 	       errno == EBUSY &&
 	       cnt-- > 0)
@@ -2055,6 +2081,7 @@ use_random:
 int flush_metadata_updates(struct supertype *st)
 {
 	int sfd;
+	int caps = 0;
 	if (!st->updates) {
 		st->update_tail = NULL;
 		return -1;
@@ -2064,14 +2091,39 @@ int flush_metadata_updates(struct supertype *st)
 	if (sfd < 0)
 		return -1;
 
+	/* Several updates go over in batches, with one reply per batch,
+	 * if mdmon understands them.
+	 */
+	if (st->updates->next) {
+		caps = mdmon_cached_caps(st->container_devnm);
+		if (caps < 0)
+			caps = mdmon_capabilities(sfd, st->container_devnm, 0);
+	}
+
 	while (st->updates) {
 		struct metadata_update *mu = st->updates;
-		st->updates = mu->next;
+		int count = 1;
+
+		if (caps > 0 && (caps & MDMON_CAP_BATCH)) {
+			for (mu = st->updates; mu->next && mu->len > 0 &&
+			     mu->next->len > 0 && count < MSG_BATCH_MAX;
+			     mu = mu->next)
+				count++;
+			mu = st->updates;
+		}
 
-		send_message(sfd, mu, 0);
+		if (count > 1)
+			send_message_batch(sfd, mu, count, 0);
+		else
+			send_message(sfd, mu, 0);
 		wait_reply(sfd, 0);
-		free(mu->buf);
-		free(mu);
+
+		while (count--) {
+			mu = st->updates;
+			st->updates = mu->next;
+			free(mu->buf);
+			free(mu);
+		}
 	}
 	ack(sfd, 0);
 	wait_reply(sfd, 0);
@@ -2440,54 +2492,107 @@ void set_hooks(void)
 	set_cmap_hooks();
 }
 
-int zero_disk_range(int fd, unsigned long long sector, size_t count)
+/*
+ * zero_range() - zero part of a block device.
+ * @fd: open block device.
+ * @offset: byte offset to start at.
+ * @len: number of bytes to zero.
+ * @method: which way of zeroing to try first, may be NULL.
+ *
+ * Offload is preferred: fallocate(FALLOC_FL_ZERO_RANGE), then the
+ * BLKZEROOUT ioctl for kernels or devices which don't support that.
+ * Only if neither works are zeroes written, with O_DIRECT where
+ * possible so as not to push everything else out of the page cache.
+ * If @method is given, the method that worked is stored there so that
+ * a caller working through a device piece by piece doesn't retry
+ * methods that have already failed.
+ *
+ * Return: 0 on success, -errno on failure.
+ */
+int zero_range(int fd, unsigned long long offset, unsigned long long len,
+	       enum zero_method *method)
 {
-	int ret = 0;
-	int fd_zero;
-	void *addr = NULL;
-	size_t written = 0;
-	size_t len = count * 512;
-	ssize_t n;
-
-	fd_zero = open("/dev/zero", O_RDONLY);
-	if (fd_zero < 0) {
-		pr_err("Cannot open /dev/zero\n");
-		return -1;
-	}
+	enum zero_method m = method ? *method : ZERO_FALLOCATE;
+	static void *zero_buf;
+	unsigned long long range[2] = { offset, len };
+	int wfd, ret = 0;
+	char path[32];
 
-	if (lseek64(fd, sector * 512, SEEK_SET) < 0) {
-		ret = -errno;
-		pr_err("Failed to seek offset for zeroing\n");
-		goto out;
-	}
-
-	addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd_zero, 0);
-
-	if (addr == MAP_FAILED) {
-		ret = -errno;
-		pr_err("Mapping /dev/zero failed\n");
-		goto out;
-	}
+	if (!len)
+		return 0;
 
-	do {
-		n = write(fd, addr + written, len - written);
-		if (n < 0) {
-			if (errno == EINTR)
-				continue;
-			ret = -errno;
-			pr_err("Zeroing disk range failed\n");
+	switch (m) {
+	case ZERO_FALLOCATE:
+		if (fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+			      offset, len) == 0)
+			break;
+		if (errno != EOPNOTSUPP && errno != EINVAL && errno != ENODEV)
+			return -errno;
+		m = ZERO_IOCTL;
+		/* fall through */
+	case ZERO_IOCTL:
+		if (ioctl(fd, BLKZEROOUT, range) == 0)
 			break;
+		if (errno != EOPNOTSUPP && errno != EINVAL && errno != ENOTTY)
+			return -errno;
+		m = ZERO_WRITE;
+		/* fall through */
+	case ZERO_WRITE:
+		if (!zero_buf) {
+			if (posix_memalign(&zero_buf, 4096, ZERO_WRITE_SIZE) != 0)
+				return -ENOMEM;
+			memset(zero_buf, 0, ZERO_WRITE_SIZE);
 		}
-		written += n;
-	} while (written != len);
 
-	munmap(addr, len);
+		/* Aligned ranges can bypass the page cache */
+		wfd = -1;
+		if (offset % 4096 == 0 && len % 4096 == 0) {
+			snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+			wfd = open(path, O_WRONLY | O_DIRECT);
+		}
+		if (wfd < 0)
+			wfd = fd;
+
+		while (len) {
+			size_t n = len < ZERO_WRITE_SIZE ? len : ZERO_WRITE_SIZE;
+			ssize_t w = pwrite(wfd, zero_buf, n, offset);
+
+			if (w < 0) {
+				if (errno == EINTR)
+					continue;
+				ret = -errno;
+				pr_err("Zeroing disk range failed\n");
+				break;
+			}
+			if (w == 0) {
+				ret = -EIO;
+				pr_err("Zeroing disk range failed\n");
+				break;
+			}
+			offset += w;
+			len -= w;
+			/* A short direct write leaves us unaligned */
+			if (wfd != fd && w % 4096) {
+				close(wfd);
+				wfd = fd;
+			}
+		}
+		if (wfd != fd)
+			close(wfd);
+		break;
+	}
 
-out:
-	close(fd_zero);
+	if (method)
+		*method = m;
 	return ret;
 }
 
+int zero_disk_range(int fd, unsigned long long sector, size_t count)
+{
+	return zero_range(fd, SEC_TO_BYTES(sector),
+			  SEC_TO_BYTES((unsigned long long)count), NULL);
+}
+
 /**
  * sleep_for() - Sleeps for specified time.
  * @sec: Seconds to sleep for.
@@ -2512,6 +2617,45 @@ void sleep_for(unsigned int sec, long nsec, bool wake_after_interrupt)
 	} while (!wake_after_interrupt && errno == EINTR);
 }
 
+/**
+ * retry_wait() - Pause before retrying something that should succeed soon.
+ * @fd: Sysfs attribute notified when the awaited change may have happened,
+ *	already read since the last wait, or -1 if there is none.
+ * @waited: Milliseconds spent waiting so far, updated.
+ * @budget: Total milliseconds allowed.
+ *
+ * Pauses start at 5ms and double up to 200ms, so a transient user that
+ * goes away quickly (udev probing a device, mdmon catching up) is noticed
+ * at once while long waits do not spin.  With @fd, return early when the
+ * attribute is notified.
+ *
+ * Return: true if the caller should retry, false once @budget is used up.
+ */
+bool retry_wait(int fd, int *waited, int budget)
+{
+	int delay = *waited;
+
+	if (*waited >= budget)
+		return false;
+	if (delay < 5)
+		delay = 5;
+	if (delay > 200)
+		delay = 200;
+	if (delay > budget - *waited)
+		delay = budget - *waited;
+
+	if (fd >= 0) {
+		int left = delay;
+
+		sysfs_wait(fd, &left);
+		*waited += delay - left;
+	} else {
+		sleep_for(0, MSEC_TO_NSEC(delay), true);
+		*waited += delay;
+	}
+	return true;
+}
+
 /* is_directory() - Checks if directory provided by path is indeed a regular directory.
  * @path: directory path to be checked
  *